@@ -5,6 +5,8 @@
 #include <string.h>
 #include <dtb.h>
 #include <slub.h>
+#include <smp.h>
+#include <zpool.h>
 
 int kern_init(void) __attribute__((noreturn));
 void grade_backtrace(void);
@@ -28,11 +30,14 @@ void print_kerninfo(void) {
 extern void slub_init(void);
 extern void slub_selftest(void);
 extern void run_slub_tests(void);
+extern void smp_bench_worker(void);
+extern void run_smp_bench(void);
 
 int kern_init(void) {
     extern char edata[], end[];
     memset(edata, 0, end - edata);
     dtb_init();
+    smp_init();
     cons_init();
 
     const char *message = "(THU.CST) os is loading ...\0";
@@ -43,13 +48,23 @@ int kern_init(void) {
     pmm_init();
 
     slub_init();
+    zpool_init();
 
     // 调测试 //
     cprintf("[slub] ### run_slub_tests entry ###\n");
     run_slub_tests();
     cprintf("[slub] ### run_slub_tests leave ###\n");
 
-    while (1) ;
+    // 拉起其余 hart，测多 hart 下 pmm 与 slub 的争用
+    smp_boot(smp_bench_worker);
+    run_smp_bench();
+
+    // 主核此后无事可做：空转时先把推迟的 struct Page 逐个 chunk 初始化完，再补预清零页池
+    zpool_refill((size_t)-1);
+    zpool_dump_stats();
+    while (1) {
+        if (pmm_init_deferred(1) == 0) zpool_refill(1);
+    }
 }
 
 
@@ -1,11 +1,15 @@
 #include <defs.h>
 #include <stdio.h>
 #include <string.h>
-#include "../debug/assert.h"
+#include <list.h>
+#include <assert.h>
 #include "mmu.h"
 #include "memlayout.h"
 #include "pmm.h"
+#include "spinlock.h"
+#include "smp.h"
 #include "slub.h"
+#include "zpool.h"
 
 /* ========= 工具：Page <-> KVA ========= */
 static inline void *page_to_kva(struct Page *pg) {
@@ -29,8 +33,69 @@ static inline struct Page *kva_to_page(void *kva) {
 #define SLUB_ALIGN      8u
 #define SLUB_NIL        0xFFFFFFFFu
 #define SLAB_MAGIC      0x51ab51abU
-#define BIG_MAGIC       0xB16B00B5U
-#define BIG_FOOT_MAGIC  0xF00DB1DEU   
+
+/*
+ * SLUB_CPU_CACHE=1：每个 hart 冻结一个 slab，在上面分配/释放不拿锁（见 struct kmem_cache_cpu）；
+ * 0 退回每次都拿 c->lock 的老路径，用来对比。
+ * SLUB_TRACE=0 关掉 slab 创建日志（宿主机基准里会刷屏）。
+ */
+#ifndef SLUB_CPU_CACHE
+#define SLUB_CPU_CACHE  1
+#endif
+#ifndef SLUB_TRACE
+#define SLUB_TRACE      1
+#endif
+
+/*
+ * 释放到全空的 slab 先留在 empty 链上，下次分配直接复用，不再一来一回地 alloc/free 页。
+ * 上下限按对象数给，各 cache 按 objs_per_slab 折成 slab 数（向上取整）：
+ * 最多留够 SLUB_EMPTY_MAX_OBJS 个对象的空 slab，超出的当场还页；slub_shrink 回收时留够 SLUB_EMPTY_MIN_OBJS 个。
+ * 默认上限是每个 hart 一批 256 个：一个 slab 只装两三个对象的大 class，几个 hart 同时整批还回来时
+ * 也能都留下，不会每批都建了又拆；内存紧张时 slub_shrink 照样把它们还掉。
+ * 运行时可用 slub_set_empty_limits 改。
+ */
+#ifndef SLUB_EMPTY_MIN_OBJS
+#define SLUB_EMPTY_MIN_OBJS  32
+#endif
+#ifndef SLUB_EMPTY_MAX_OBJS
+#define SLUB_EMPTY_MAX_OBJS  (256 * NR_HARTS)
+#endif
+
+/*
+ * slab 的页数按 class 选：从 0 阶起取第一个浪费不超过 SLUB_WASTE_PCT% 的阶，最多 SLUB_SLAB_MAX_ORDER 阶。
+ * obj_size >= SLUB_OFF_SLAB_MIN 的 class 把 slab 头放到页外（slab_meta 里），页里全是对象：
+ * 2048 一页能放 2 个而不是 1 个。设得比最大 class 还大就全部放页内。
+ */
+#ifndef SLUB_WASTE_PCT
+#define SLUB_WASTE_PCT      10
+#endif
+#ifndef SLUB_SLAB_MAX_ORDER
+#define SLUB_SLAB_MAX_ORDER 3
+#endif
+#ifndef SLUB_OFF_SLAB_MIN
+#define SLUB_OFF_SLAB_MIN   512
+#endif
+
+/*
+ * slab 的每一页都打上 PG_slab，页在 slab 里时不挂 pmm 的任何链，借 page_link.next 存 slab 头，
+ * 任意对象指针 O(1) 找回所属 slab。pmm 管理器的私有位用到 bit 4，这里从 bit 8 起。
+ */
+#define PG_slab 8
+#define SetPageSlab(page)   set_bit(PG_slab, &((page)->flags))
+#define ClearPageSlab(page) clear_bit(PG_slab, &((page)->flags))
+#define PageSlab(page)      test_bit(PG_slab, &((page)->flags))
+
+/*
+ * 大块（超过最大 class）整页分配，对象里不放任何头：每一页都打 PG_large，page_link.next 指向首页，
+ * 页数记在首页的 property（分出去的页 pmm 不看 property，还页时各管理器自己重写）。返回首页地址，天然页对齐。
+ *
+ * 于是 kfree/ksize 查一次 p 所在页的描述符就知道它是什么：PG_slab 是 slab 里的对象，PG_large 是大块里的一页，
+ * 都不是就不是 slub 分出去的。不读 p 前后的内存去猜，也不会被相邻对象里像头的内容骗到。
+ */
+#define PG_large 9
+#define SetPageLarge(page)   set_bit(PG_large, &((page)->flags))
+#define ClearPageLarge(page) clear_bit(PG_large, &((page)->flags))
+#define PageLarge(page)      test_bit(PG_large, &((page)->flags))
 
 static inline size_t align_up(size_t x, size_t a) {
     return (x + a - 1) / a * a;
@@ -39,38 +104,121 @@ static inline size_t align_up(size_t x, size_t a) {
 /* ========= 元数据 ========= */
 struct kmem_cache;
 
+/* slab 挂在哪条链上；刚建好的和冻结的 slab 不在任何链上 */
+enum slab_state {
+    SLAB_PARTIAL,           /* 有空位 */
+    SLAB_FULL,              /* 满 */
+    SLAB_EMPTY,             /* 全空 */
+    SLAB_NSTATES,
+    SLAB_DETACHED = SLAB_NSTATES,
+};
+
 struct slub_slab {
     struct kmem_cache *cache;
-    struct slub_slab  *next;
+    list_entry_t link;      /* cache->lists[state] 上的双向链 */
+    uintptr_t base;         /* 0 号对象的地址；页内头时紧跟在头后面 */
     uint16_t total;
-    uint16_t inuse;
+    uint16_t inuse;         /* 冻结期间 hart 私有链上的对象也算在用 */
+    uint16_t frozen;        /* 冻结在哪个 hart 上（hartid+1）；0 表示归 cache 的链表管 */
+    uint8_t  state;         /* enum slab_state */
+    uint8_t  order;         /* 占 2^order 页；内存紧时可能比 cache 的 order 小 */
     uint32_t free_head;     /* free-list 存在对象首 U32 */
     uint32_t magic;         /* SLAB_MAGIC */
 };
 
+/*
+ * 每 hart 一份：冻结一个 slab，把它的 free-list 整条搬进 free_head，之后本 hart
+ * 在这个 slab 上分配、释放都不拿锁。冻结的 slab 不在任何链表上。
+ * 别的 hart 释放进来的对象压进 remote（无锁栈，链接放在对象首 8 字节），
+ * owner 的私有链用完时一次换走整条，属于当前 slab 的直接收进私有链，其余拿一次锁归还。
+ * 和 c->lock 一样只防多 hart，不防中断重入，中断里不能 kmalloc。
+ */
+struct kmem_cache_cpu {
+    struct slub_slab *slab;     /* 冻结在本 hart 上的 slab */
+    uint32_t free_head;         /* 私有 free-list（slab 内下标） */
+    uint32_t nfree;
+    void *remote;               /* 远端释放队列，别的 hart CAS 入栈 */
+    size_t alloc_fast, alloc_slow;
+    size_t free_fast, free_remote, free_slow;
+    size_t remote_drained;
+} __attribute__((aligned(64)));
+
 struct kmem_cache {
+    spinlock_t lock;        /* 保护下面三条链表与各 slab 的 free-list */
+    const char *name;       /* kmalloc 的 class 为 NULL，统计里按大小起名 */
     size_t obj_size;        /* 请求大小（外部可见） */
     size_t obj_stride;      /* 实际步长（含对齐）   */
-    size_t objs_per_slab;
-    struct slub_slab *partial;  /* 有空位 */
-    struct slub_slab *full;     /* 满 */
-    struct slub_slab *empty;    /* 暂不用：释放到 0 直接还页，避免内存涨 */
+    size_t align;           /* 对象地址按它对齐，2 的幂，至少 SLUB_ALIGN */
+    size_t obj_off;         /* 0 号对象距 slab 首页页首的偏移 */
+    size_t free_off;        /* free-list 链接在对象里的偏移，见 obj_free_slot */
+    void (*ctor)(void *);   /* 建 slab 时对每个对象调一次 */
+    size_t objs_per_slab;   /* 按 order 建的 slab 里的对象数 */
+    unsigned order;         /* slab 占 2^order 页 */
+    bool off_slab;          /* slab 头放在页外 */
+    list_entry_t lists[SLAB_NSTATES];   /* partial / full / empty，按 enum slab_state 下标 */
+    size_t nr_slabs[SLAB_NSTATES];      /* 各链长度 */
+    size_t empty_min, empty_max;        /* 空 slab 保留数的下限（shrink 时）与上限，由对象数折算 */
+    size_t slab_creates, slab_destroys; /* 向 pmm 要页 / 还页的次数 */
+    size_t empty_reuses;                /* 从 empty 链复用的次数 */
+    size_t shrunk;                      /* 被 shrink 回收的空 slab 数 */
+    list_entry_t list;                  /* 挂在 slab_caches 上 */
+    struct kmem_cache_cpu cpu[NR_HARTS];
 };
 
-/* 固定 size-classes（8..2048） */
-static const size_t size_classes[] = {8,16,32,64,128,256,512,1024,2048,0};
-#define N_CACHES 9
+/*
+ * size-classes：2 的幂之间插一档（1.5 倍），129B 落到 192 而不是 256，最坏浪费从 50% 降到 33%。
+ * 可用 -DSLUB_SIZE_CLASSES=8,16,...,2048 换一套：须升序、都是 SLUB_ALIGN 的倍数、不超过 SLUB_MAX_SMALL。
+ */
+#ifndef SLUB_SIZE_CLASSES
+#define SLUB_SIZE_CLASSES 8,16,32,48,64,96,128,192,256,384,512,768,1024,1536,2048
+#endif
+#define SLUB_MAX_SMALL    2048
+static const size_t size_classes[] = {SLUB_SIZE_CLASSES};
+#define N_CACHES ((int)(sizeof(size_classes) / sizeof(size_classes[0])))
 static struct kmem_cache caches[N_CACHES];
+/* (n-1)>>3 -> class 下标，slub_init 时按 size_classes 填好 */
+static uint8_t size_index[SLUB_MAX_SMALL / SLUB_ALIGN];
+/* 页外 slab 头从这里分；它自己的头永远在页内，只走加锁路径 */
+static struct kmem_cache slab_meta;
+/* kmem_cache_create 建的 cache 本身从这里分，同样只走加锁路径 */
+static struct kmem_cache cache_cache;
+
+/*
+ * 所有 cache 都挂在 slab_caches 上，按 kmalloc 各 class、kmem_cache_create 建的、cache_cache、slab_meta 排：
+ * 新建的插在 cache_cache 前面，slab_meta 永远最后，shrink 时前面还掉的页外头先回到它。
+ * 锁序：slub_lock 在 c->lock 外；持着 c->lock 的路径只能 trylock 它。
+ */
+static spinlock_t   slub_lock;
+static list_entry_t slab_caches;
+#define le2cache(le) to_struct((le), struct kmem_cache, list)
+#define for_each_cache(c) \
+    for (list_entry_t *__le = list_next(&slab_caches); \
+         __le != &slab_caches && ((c) = le2cache(__le), 1); __le = list_next(__le))
 
 /* ========= slab 辅助 ========= */
-static inline struct slub_slab *kva_to_slab(void *kva_page_base) {
-    return (struct slub_slab *)kva_page_base;
-}
+#define SLAB_HDR_SIZE ROUNDUP(sizeof(struct slub_slab), SLUB_ALIGN)
 
 static inline void *slab_obj_base(struct slub_slab *slab) {
-    uintptr_t base = (uintptr_t)slab;
-    uintptr_t obj0 = ROUNDUP(base + sizeof(struct slub_slab), SLUB_ALIGN);
-    return (void *)obj0;
+    return (void *)slab->base;
+}
+
+/*
+ * 空闲对象里存 free-list 的下一个下标（u32），进远端队列时存下一个对象的指针。
+ * kmalloc 的 class 放在对象首；带 ctor 的 cache 放在对象尾后面多留的 8 字节里，
+ * 构造好的内容在 free/alloc 之间原样保留。
+ */
+static inline uint32_t *obj_free_slot(struct kmem_cache *c, void *obj) {
+    return (uint32_t *)((uintptr_t)obj + c->free_off);
+}
+static inline void **obj_remote_link(struct kmem_cache *c, void *obj) {
+    return (void **)((uintptr_t)obj + c->free_off);
+}
+
+/* 对象指针 -> 所属 slab；不在 slab 页里返回 NULL */
+static inline struct slub_slab *obj_to_slab(void *p) {
+    struct Page *pg = kva_to_page(p);
+    if (!PageSlab(pg)) return NULL;
+    return (struct slub_slab *)pg->page_link.next;
 }
 
 static inline void *slab_index_to_ptr(struct slub_slab *slab, uint32_t idx) {
@@ -83,321 +231,971 @@ static inline uint32_t slab_ptr_to_index(struct slub_slab *slab, void *p) {
                       slab->cache->obj_stride);
 }
 
-/* 兜底：重建某 slab 的 free-list（当发现损坏时使用） */
-static void slab_rebuild_freelist(struct slub_slab *slab) {
-    uintptr_t obj0 = (uintptr_t)slab_obj_base(slab);
-    uint32_t n = (uint32_t)slab->total;
-    for (uint32_t i = 0; i < n; ++i) {
-        uint32_t *slot = (uint32_t *)(obj0 + slab->cache->obj_stride * i);
-        *slot = (i + 1 < n) ? (i + 1) : SLUB_NIL;
+/* 2^order 页的 slab 能放几个对象 */
+static size_t slab_capacity(struct kmem_cache *c, unsigned order) {
+    size_t bytes = (size_t)PGSIZE << order;
+    size_t nobj  = (bytes - c->obj_off) / c->obj_stride;
+    return nobj < SLUB_NIL && nobj <= 0xFFFF ? nobj : 0xFFFF;
+}
+
+/* 浪费 = 整个 slab（页外头也算上）里不是对象的部分，千分比 */
+static size_t slab_waste_permille(struct kmem_cache *c, unsigned order) {
+    size_t bytes = ((size_t)PGSIZE << order) + (c->off_slab ? SLAB_HDR_SIZE : 0);
+    size_t used  = slab_capacity(c, order) * c->obj_size;
+    return (bytes - used) * 1000 / bytes;
+}
+
+/* 选头放哪、几阶：第一个达到浪费目标的阶，都达不到就取浪费最少的；最大阶也放不下一个对象时 objs_per_slab 为 0 */
+static void cache_pick_layout(struct kmem_cache *c, bool allow_off_slab) {
+    c->off_slab = allow_off_slab && c->obj_size >= SLUB_OFF_SLAB_MIN;
+    c->obj_off  = c->off_slab ? 0 : align_up(SLAB_HDR_SIZE, c->align);
+    unsigned best = 0;
+    for (unsigned o = 0; o <= SLUB_SLAB_MAX_ORDER; ++o) {
+        if (slab_capacity(c, o) == 0) continue;
+        if (slab_capacity(c, best) == 0 ||
+            slab_waste_permille(c, o) < slab_waste_permille(c, best)) best = o;
+        if (slab_waste_permille(c, o) <= SLUB_WASTE_PCT * 10) break;
     }
-    slab->free_head = 0;
-    slab->inuse = 0;
+    c->order = best;
+    c->objs_per_slab = slab_capacity(c, best);
 }
 
+static void *cache_alloc_locked(struct kmem_cache *c);
+static void slab_free_locked(struct kmem_cache *c, struct slub_slab *slab, uint32_t idxobj);
+static size_t cache_shrink_others(struct kmem_cache *c);
+
 /* ========= slab create/destroy ========= */
+static struct Page *slab_alloc_pages(struct kmem_cache *c, unsigned *order) {
+    /* 对象被内核指针长期引用，挪不动，按不可移动类型分配，别把可移动的 pageblock 钉碎 */
+    struct Page *pg = alloc_pages_mt((size_t)1 << *order, MT_UNMOVABLE);
+    /* 页不够：别的 cache 留着的空 slab 先还回去再试一次 */
+    if (!pg && cache_shrink_others(c) > 0) pg = alloc_pages_mt((size_t)1 << *order, MT_UNMOVABLE);
+    /* 连续页不够：退到放得下一个对象的最小阶 */
+    while (!pg && *order > 0 && slab_capacity(c, *order - 1) > 0) {
+        --*order;
+        pg = alloc_pages_mt((size_t)1 << *order, MT_UNMOVABLE);
+    }
+    return pg;
+}
+
 static struct slub_slab *slab_create(struct kmem_cache *c) {
-    struct Page *pg = alloc_pages(1);
+    unsigned order = c->order;
+    struct Page *pg = slab_alloc_pages(c, &order);
     if (!pg) return NULL;
 
-    void *base = page_to_kva(pg);
-    struct slub_slab *slab = kva_to_slab(base);
+    void *mem = page_to_kva(pg);
+    struct slub_slab *slab;
+    if (c->off_slab) {
+        /* 锁序：大 class 的 c->lock 在外，slab_meta.lock 在里 */
+        spin_lock(&slab_meta.lock);
+        slab = cache_alloc_locked(&slab_meta);
+        spin_unlock(&slab_meta.lock);
+        if (!slab) { free_pages(pg, (size_t)1 << order); return NULL; }
+    } else {
+        slab = (struct slub_slab *)mem;
+    }
+    c->slab_creates++;
+
     memset(slab, 0, sizeof(*slab));
     slab->cache = c;
     slab->magic = SLAB_MAGIC;
+    slab->order = (uint8_t)order;
+    slab->base  = (uintptr_t)mem + c->obj_off;
 
-    uintptr_t obj0 = (uintptr_t)slab_obj_base(slab);
-    size_t usable = PGSIZE - (obj0 - (uintptr_t)slab);
-    size_t nobj   = usable / c->obj_stride;
-    if (nobj == 0) { free_pages(pg, 1); return NULL; }
+    for (size_t i = 0; i < ((size_t)1 << order); ++i) {
+        SetPageSlab(pg + i);
+        pg[i].page_link.next = (list_entry_t *)slab;
+    }
+
+    uintptr_t obj0 = slab->base;
+    size_t nobj   = slab_capacity(c, order);
 
     slab->total = (uint16_t)nobj;
     slab->inuse = 0;
-    slab->next  = NULL;
+    slab->state = SLAB_DETACHED;
 
     for (uint32_t i = 0; i < nobj; ++i) {
-        uint32_t *slot = (uint32_t *)(obj0 + c->obj_stride * i);
-        *slot = (i + 1 < nobj) ? (i + 1) : SLUB_NIL;
+        void *obj = (void *)(obj0 + c->obj_stride * i);
+        if (c->ctor) c->ctor(obj);
+        *obj_free_slot(c, obj) = (i + 1 < nobj) ? (i + 1) : SLUB_NIL;
     }
     slab->free_head = 0;
-    if (c->objs_per_slab == 0) c->objs_per_slab = nobj;
 
-    cprintf("[slub] create: class=%u stride=%u obj_off=0x%x usable=%u nobj=%u\n",
-        (unsigned)c->obj_size, (unsigned)c->obj_stride,
-        (unsigned)(obj0 - (uintptr_t)slab),
-        (unsigned)usable, (unsigned)nobj);
+    if (SLUB_TRACE)
+        cprintf("[slub] create: class=%u stride=%u order=%u %s obj_off=0x%x nobj=%u\n",
+            (unsigned)c->obj_size, (unsigned)c->obj_stride, order,
+            c->off_slab ? "off-slab" : "on-slab",
+            (unsigned)(obj0 - (uintptr_t)mem), (unsigned)nobj);
 
     return slab;
 }
 
 static void slab_destroy(struct slub_slab *slab) {
-    /* 页首的 slab 头一定在页对齐处 */
     assert(slab->magic == SLAB_MAGIC);
-    free_pages(kva_to_page((void *)slab), 1);
+    assert(slab->state == SLAB_DETACHED);
+    struct kmem_cache *c = slab->cache;
+    struct Page *pg = kva_to_page((void *)ROUNDDOWN(slab->base, PGSIZE));
+    size_t np = (size_t)1 << slab->order;
+    c->slab_destroys++;
+    for (size_t i = 0; i < np; ++i) {
+        ClearPageSlab(pg + i);
+        pg[i].page_link.next = NULL;
+    }
+    slab->magic = 0;
+    if (c->off_slab) {
+        spin_lock(&slab_meta.lock);
+        struct slub_slab *ms = obj_to_slab(slab);
+        slab_free_locked(&slab_meta, ms, slab_ptr_to_index(ms, slab));
+        spin_unlock(&slab_meta.lock);
+    }
+    free_pages(pg, np);
+}
+
+/* ========= cache 链表操作（均 O(1)） ========= */
+#define le2slab(le) to_struct((le), struct slub_slab, link)
+
+/* 从原来的链摘下、挂到 state 对应的链头；SLAB_DETACHED 只摘不挂 */
+static void slab_set_state(struct kmem_cache *c, struct slub_slab *s, int state) {
+    if (s->state == state) return;
+    if (s->state != SLAB_DETACHED) {
+        list_del(&s->link);
+        c->nr_slabs[s->state]--;
+    }
+    if (state != SLAB_DETACHED) {
+        list_add(&c->lists[state], &s->link);
+        c->nr_slabs[state]++;
+    }
+    s->state = state;
 }
 
-/* ========= cache 链表操作 ========= */
-static void cache_push_partial(struct kmem_cache *c, struct slub_slab *s) {
-    s->next = c->partial; c->partial = s;
+/* 按 inuse 归到对应的链上 */
+static void slab_place(struct kmem_cache *c, struct slub_slab *s) {
+    int state = s->inuse == 0 ? SLAB_EMPTY : s->inuse < s->total ? SLAB_PARTIAL : SLAB_FULL;
+    slab_set_state(c, s, state);
 }
-static void cache_push_full(struct kmem_cache *c, struct slub_slab *s) {
-    s->next = c->full; c->full = s;
+
+static struct slub_slab *cache_first(struct kmem_cache *c, int state) {
+    if (list_empty(&c->lists[state])) return NULL;
+    return le2slab(list_next(&c->lists[state]));
 }
-static struct slub_slab *cache_pop_partial(struct kmem_cache *c) {
-    struct slub_slab *s = c->partial;
-    if (s) { c->partial = s->next; s->next = NULL; }
+
+/* 有空位的 slab：先 partial（把半空的填满），再复用 empty，最后才新建；不摘链 */
+static struct slub_slab *cache_slab_with_space(struct kmem_cache *c) {
+    struct slub_slab *s = cache_first(c, SLAB_PARTIAL);
+    if (s) return s;
+    s = cache_first(c, SLAB_EMPTY);
+    if (s) {
+        c->empty_reuses++;
+        return s;
+    }
+    return slab_create(c);
+}
+
+/* 取一个有空位的 slab 并摘下 */
+static struct slub_slab *cache_pop_slab_with_space(struct kmem_cache *c) {
+    struct slub_slab *s = cache_slab_with_space(c);
+    if (s) slab_set_state(c, s, SLAB_DETACHED);
     return s;
 }
-static void cache_unlink(struct kmem_cache *c, struct slub_slab *slab) {
-    struct slub_slab **pp = &c->partial;
-    while (*pp) {
-        if (*pp == slab) { *pp = slab->next; slab->next = NULL; return; }
-        pp = &(*pp)->next;
+
+/* 对象数折成本 cache 的 slab 数，向上取整 */
+static size_t objs_to_slabs(struct kmem_cache *c, size_t objs) {
+    size_t per = c->objs_per_slab > 0 ? c->objs_per_slab : 1;
+    return (objs + per - 1) / per;
+}
+
+/* slab 释放到全空：empty 链没满就留着，满了还页 */
+static void slab_retire(struct kmem_cache *c, struct slub_slab *s) {
+    if (c->nr_slabs[SLAB_EMPTY] < c->empty_max) {
+        slab_set_state(c, s, SLAB_EMPTY);
+    } else {
+        slab_set_state(c, s, SLAB_DETACHED);
+        slab_destroy(s);
     }
-    pp = &c->full;
-    while (*pp) {
-        if (*pp == slab) { *pp = slab->next; slab->next = NULL; return; }
-        pp = &(*pp)->next;
+}
+
+/* 持 c->lock：empty 链只留 keep 个，其余从最久没用的一头还页；返回还掉的页数 */
+static size_t cache_shrink_locked(struct kmem_cache *c, size_t keep) {
+    size_t n = 0;
+    while (c->nr_slabs[SLAB_EMPTY] > keep) {
+        struct slub_slab *s = le2slab(list_prev(&c->lists[SLAB_EMPTY]));
+        slab_set_state(c, s, SLAB_DETACHED);
+        n += (size_t)1 << s->order;
+        slab_destroy(s);
+        c->shrunk++;
     }
+    return n;
 }
 
-/* 取一个有空位的 slab（优先 partial，没则新建） */
-static struct slub_slab *cache_pop_slab_with_space(struct kmem_cache *c) {
-    struct slub_slab *s = cache_pop_partial(c);
-    if (s) return s;
-    return slab_create(c);
+/* 持 c->lock 时把一个对象还给所属 slab；冻结的 slab 不在链表上，由 owner 解冻时归位 */
+static void slab_free_locked(struct kmem_cache *c, struct slub_slab *slab, uint32_t idxobj) {
+    uint32_t *slot = obj_free_slot(c, slab_index_to_ptr(slab, idxobj));
+    *slot = slab->free_head;
+    slab->free_head = idxobj;
+    assert(slab->inuse > 0);
+    slab->inuse--;
+    if (slab->frozen) return;
+
+    /* 释放后仍是 partial 的不动链表，只有 满->有空位、有空位->全空 两种迁移 */
+    if (slab->inuse == 0) {
+        slab_retire(c, slab);
+    } else if (slab->state == SLAB_FULL) {
+        slab_set_state(c, slab, SLAB_PARTIAL);
+    }
 }
 
-/* ========= class 选择 ========= */
-static int class_index(size_t n) {
-    for (int i = 0; i < N_CACHES; ++i)
-        if (n <= size_classes[i]) return i;
-    return -1;
+/* ========= 每 hart 缓存 ========= */
+static inline struct kmem_cache_cpu *this_cpu(struct kmem_cache *c) {
+    int h = cpuid();
+    assert(h >= 0 && h < NR_HARTS);
+    return &c->cpu[h];
 }
 
-/* ========= 大块（>2KB）走页 =========
- * 设计：双头标记，既在页首放 big_hdr，也在“返回指针前面”再放一份 hdr，
- * 避免被页首误分类或用户指针被篡改时难以恢复。free 时优先检查“p-1 头”。
+/* head..tail 已经用远端链接串好（单个对象时 head == tail），一次 CAS 整串入栈 */
+static void remote_push(struct kmem_cache *c, struct kmem_cache_cpu *owner, void *head, void *tail) {
+    void *old = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+    do {
+        *obj_remote_link(c, tail) = old;
+    } while (!__atomic_compare_exchange_n(&owner->remote, &old, head, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* 整条换走远端队列：当前 slab 的对象收进私有链，别的 slab 的攒一次锁还掉 */
+static void cpu_drain_remote(struct kmem_cache *c, struct kmem_cache_cpu *cc) {
+    void *p = __atomic_exchange_n(&cc->remote, NULL, __ATOMIC_ACQUIRE);
+    int locked = 0;
+    while (p) {
+        void *next = *obj_remote_link(c, p);
+        struct slub_slab *slab = obj_to_slab(p);
+        uint32_t idxobj = slab_ptr_to_index(slab, p);
+        if (slab == cc->slab) {
+            *obj_free_slot(c, p) = cc->free_head;
+            cc->free_head = idxobj;
+            cc->nfree++;
+        } else {
+            if (!locked) { spin_lock(&c->lock); locked = 1; }
+            slab_free_locked(c, slab, idxobj);
+        }
+        cc->remote_drained++;
+        p = next;
+    }
+    if (locked) spin_unlock(&c->lock);
+}
+
+/* 持 c->lock：私有链接回 slab，slab 回到 cache 的链表（空了就还页） */
+static void cpu_unfreeze(struct kmem_cache *c, struct kmem_cache_cpu *cc) {
+    struct slub_slab *slab = cc->slab;
+    if (!slab) return;
+    while (cc->free_head != SLUB_NIL) {
+        uint32_t idxobj = cc->free_head;
+        uint32_t *slot = obj_free_slot(c, slab_index_to_ptr(slab, idxobj));
+        cc->free_head = *slot;
+        *slot = slab->free_head;
+        slab->free_head = idxobj;
+    }
+    assert(slab->inuse >= cc->nfree);
+    slab->inuse -= cc->nfree;
+    cc->nfree = 0;
+    cc->slab = NULL;
+    __atomic_store_n(&slab->frozen, 0, __ATOMIC_RELEASE);
+
+    if (slab->inuse == 0) slab_retire(c, slab);
+    else                  slab_place(c, slab);
+}
+
+/*
+ * 私有链空了：先收远端队列；还不够就拿锁，冻结中的 slab 上若有别处加锁还回来的对象就整条接过来，
+ * 否则把它解冻、换一个 partial（或新建）的 slab 冻结。返回 0 表示没内存。
  */
-struct big_hdr {
-    uint32_t magic;     /* BIG_MAGIC   */
-    uint32_t npages;    /* 连续页数     */
-    uint32_t guard;     /* BIG_FOOT_MAGIC */
-    uint32_t _pad;      /* 对齐 */
-};
+static int cpu_refill(struct kmem_cache *c, struct kmem_cache_cpu *cc) {
+    if (__atomic_load_n(&cc->remote, __ATOMIC_RELAXED) != NULL) {
+        cpu_drain_remote(c, cc);
+        if (cc->free_head != SLUB_NIL) return 1;
+    }
 
-static void *big_alloc(size_t n) {
-    size_t need = n + sizeof(struct big_hdr) * 2;   /* 双头 */
-    size_t np   = (need + PGSIZE - 1) / PGSIZE;
+    spin_lock(&c->lock);
+    struct slub_slab *slab = cc->slab;
+    if (!slab || slab->free_head == SLUB_NIL) {
+        cpu_unfreeze(c, cc);
+        slab = cache_pop_slab_with_space(c);
+        if (!slab) {
+            spin_unlock(&c->lock);
+            return 0;
+        }
+        cc->slab = slab;
+        __atomic_store_n(&slab->frozen, (uint16_t)(cpuid() + 1), __ATOMIC_RELEASE);
+    }
+    cc->free_head = slab->free_head;
+    cc->nfree = slab->total - slab->inuse;
+    slab->free_head = SLUB_NIL;
+    slab->inuse = slab->total;
+    spin_unlock(&c->lock);
+    return 1;
+}
 
-    struct Page *pg = alloc_pages(np);
-    if (!pg) return NULL;
+static void cpu_flush(struct kmem_cache *c, struct kmem_cache_cpu *cc) {
+    cpu_drain_remote(c, cc);
+    spin_lock(&c->lock);
+    cpu_unfreeze(c, cc);
+    spin_unlock(&c->lock);
+}
 
-    void *base = page_to_kva(pg);
+/* ========= class 选择 ========= */
+static inline int class_index(size_t n) {
+    if (n > size_classes[N_CACHES - 1]) return -1;
+    return size_index[(n - 1) >> 3];
+}
 
-    /* 页首头 */
-    struct big_hdr *h0 = (struct big_hdr *)base;
-    h0->magic  = BIG_MAGIC;
-    h0->npages = (uint32_t)np;
-    h0->guard  = BIG_FOOT_MAGIC;
-    h0->_pad   = 0;
+static void size_index_init(void) {
+    int k = 0;
+    for (size_t i = 0; i < SLUB_MAX_SMALL / SLUB_ALIGN; ++i) {
+        size_t n = (i + 1) * SLUB_ALIGN;
+        while (k < N_CACHES - 1 && size_classes[k] < n) k++;
+        size_index[i] = (uint8_t)k;
+    }
+}
 
-    /* 返回给用户的指针 */
-    uint8_t *ret = (uint8_t *)base + sizeof(struct big_hdr);
+/* ========= 大块（>2KB）走页 ========= */
+static void *big_alloc(size_t n, unsigned flags) {
+    size_t np = (n + PGSIZE - 1) / PGSIZE;
 
-    /* 返回指针前的“镜像头”，用于更稳健的 free 判定 */
-    struct big_hdr *h1 = (struct big_hdr *)(ret - sizeof(struct big_hdr));
-    *h1 = *h0;
+    /* 整页都是干净的，不必再清零 */
+    struct Page *pg = (flags & KM_ZERO) ? alloc_pages_zeroed(np)
+                                        : alloc_pages_mt(np, MT_UNMOVABLE);
+    if (!pg && slub_shrink(1) > 0)
+        pg = (flags & KM_ZERO) ? alloc_pages_zeroed(np) : alloc_pages_mt(np, MT_UNMOVABLE);
+    if (!pg) return NULL;
 
-    return ret;
+    for (size_t i = 0; i < np; ++i) {
+        SetPageLarge(pg + i);
+        pg[i].page_link.next = (list_entry_t *)pg;
+    }
+    pg->property = (unsigned int)np;
+    return page_to_kva(pg);
 }
 
-static void big_free_by_hdr(struct big_hdr *h) {
-    if (h->magic != BIG_MAGIC || h->guard != BIG_FOOT_MAGIC) {
-        cprintf("[slub] E: big_free header broken: magic=0x%x guard=0x%x\n",
-                h->magic, h->guard);
-        assert(0);
+static void big_free(struct Page *pg) {
+    size_t np = pg->property;
+    assert(np > 0);
+    /* 先清标志，同一指针再 free 一次会在分类时被抓到 */
+    for (size_t i = 0; i < np; ++i) {
+        ClearPageLarge(pg + i);
+        pg[i].page_link.next = NULL;
     }
-    /* 将 magic 清零以防双 free */
-    uint32_t np = h->npages;
-    h->magic = 0; h->guard = 0;
-    void *base = (void *)ROUNDDOWN((uintptr_t)h, PGSIZE);  
-    free_pages(kva_to_page(base), np);
+    pg->property = 0;
+    free_pages(pg, np);
 }
 
 /* ========= 初始化 ========= */
+/* 按大小、对齐、有没有 ctor 排版；最大阶的 slab 也放不下一个对象时返回 0 */
+static bool cache_init(struct kmem_cache *c, const char *name, size_t s, size_t align,
+                       void (*ctor)(void *), bool allow_off_slab) {
+    memset(c, 0, sizeof(*c));
+    /* 有 ctor 时 free-list 链接挪到对象后面，对象本身一个字节都不碰 */
+    size_t need = s > sizeof(void *) ? s : sizeof(void *);
+    if (ctor) need = align_up(s, sizeof(void *)) + sizeof(void *);
+    c->name          = name;
+    c->obj_size      = s;
+    c->align         = align;
+    c->obj_stride    = align_up(need, align);
+    c->free_off      = ctor ? align_up(s, sizeof(void *)) : 0;
+    c->ctor          = ctor;
+    cache_pick_layout(c, allow_off_slab);
+    for (int st = 0; st < SLAB_NSTATES; ++st) {
+        list_init(&c->lists[st]);
+        c->nr_slabs[st] = 0;
+    }
+    spin_lock_init(&c->lock);
+    c->empty_min = objs_to_slabs(c, SLUB_EMPTY_MIN_OBJS);
+    c->empty_max = objs_to_slabs(c, SLUB_EMPTY_MAX_OBJS);
+    for (int h = 0; h < NR_HARTS; ++h) c->cpu[h].free_head = SLUB_NIL;
+    return c->objs_per_slab > 0;
+}
+
 void slub_init(void) {
+    spin_lock_init(&slub_lock);
+    list_init(&slab_caches);
     for (int i = 0; i < N_CACHES; ++i) {
-        size_t s      = size_classes[i];
-        size_t stride = align_up(s > sizeof(uint32_t) ? s : sizeof(uint32_t),
-                                 SLUB_ALIGN);
-        caches[i].obj_size      = s;
-        caches[i].obj_stride    = stride;
-        caches[i].objs_per_slab = 0;
-        caches[i].partial = caches[i].full = caches[i].empty = NULL;
+        assert(size_classes[i] % SLUB_ALIGN == 0 && size_classes[i] <= SLUB_MAX_SMALL);
+        assert(i == 0 || size_classes[i] > size_classes[i - 1]);
+        assert(cache_init(&caches[i], NULL, size_classes[i], SLUB_ALIGN, NULL, 1));
+        list_add_before(&slab_caches, &caches[i].list);
     }
-    cprintf("[slub] init %d caches (8..2048)\n", N_CACHES);
+    assert(cache_init(&cache_cache, "kmem_cache", sizeof(struct kmem_cache),
+                      __alignof__(struct kmem_cache), NULL, 0));
+    list_add_before(&slab_caches, &cache_cache.list);
+    assert(cache_init(&slab_meta, "slab_meta", sizeof(struct slub_slab), SLUB_ALIGN, NULL, 0));
+    list_add_before(&slab_caches, &slab_meta.list);
+    size_index_init();
+    cprintf("[slub] init %d caches (%u..%u)\n", N_CACHES,
+            (unsigned)size_classes[0], (unsigned)size_classes[N_CACHES - 1]);
 }
 
 /* ========= 分配 ========= */
-void *slub_alloc(size_t n) {
-    if (n == 0) n = 1;
-    int idx = class_index(n);
-    if (idx < 0) return big_alloc(n);
-
-    struct kmem_cache *c = &caches[idx];
-    struct slub_slab *slab = cache_pop_slab_with_space(c);
+/* 持 c->lock：partial 链头上的 slab 就地分配，不摘链；只有变满时才挪到 full */
+static void *cache_alloc_locked(struct kmem_cache *c) {
+    struct slub_slab *slab = cache_slab_with_space(c);
     if (!slab) return NULL;
 
-    /* 必要时重建 free-list（防止被人为覆盖） */
-    if (slab->free_head == SLUB_NIL) {
-        cprintf("[slub] warn: free_head==NIL, rebuild freelist (class=%u)\n",
-                (unsigned)c->obj_size);
-        slab_rebuild_freelist(slab);
-    }
-    assert(slab->free_head != SLUB_NIL);
+    /* partial/empty 上的 slab 一定还有空位；没有说明状态或 free-list 坏了，重建会把在用的对象再发出去 */
+    assert(slab->free_head != SLUB_NIL && slab->inuse < slab->total);
 
     uint32_t idxobj = slab->free_head;
     void *obj = slab_index_to_ptr(slab, idxobj);
 
-    uint32_t *slot = (uint32_t *)obj;
+    uint32_t *slot = obj_free_slot(c, obj);
     slab->free_head = *slot;
     slab->inuse++;
 
-    if (slab->inuse < slab->total) cache_push_partial(c, slab);
-    else                           cache_push_full(c, slab);
+    slab_place(c, slab);
     return obj;
 }
 
-/* ========= 释放 ========= */
-void slub_free(void *p) {
-    if (!p) return;
+static void *cache_alloc(struct kmem_cache *c) {
+#if SLUB_CPU_CACHE
+    struct kmem_cache_cpu *cc = this_cpu(c);
+    if (cc->free_head != SLUB_NIL)  cc->alloc_fast++;
+    else if (cpu_refill(c, cc))     cc->alloc_slow++;
+    else                            return NULL;
 
-    /* 先尝试“大块”的“p-1 镜像头” */
-    struct big_hdr *h1 = (struct big_hdr *)((uint8_t *)p - sizeof(struct big_hdr));
-    if (h1->magic == BIG_MAGIC && h1->guard == BIG_FOOT_MAGIC) {
-        big_free_by_hdr(h1);
-        return;
-    }
+    void *obj = slab_index_to_ptr(cc->slab, cc->free_head);
+    cc->free_head = *obj_free_slot(c, obj);
+    cc->nfree--;
+#else
+    spin_lock(&c->lock);
+    void *obj = cache_alloc_locked(c);
+    this_cpu(c)->alloc_slow++;
+    spin_unlock(&c->lock);
+#endif
+    return obj;
+}
 
-    /* 再看页首：可能是小对象 slab 或 大块页首头 */
-    void *base = (void *)ROUNDDOWN((uintptr_t)p, PGSIZE);
+void *slub_alloc(size_t n) {
+    return slub_alloc_flags(n, 0);
+}
 
-    /* 小对象 slab */
-    struct slub_slab *as_slab = (struct slub_slab *)base;
-    if (as_slab->magic == SLAB_MAGIC) {
-        struct slub_slab *slab = as_slab;
-        struct kmem_cache *c   = slab->cache;
+void *slub_alloc_flags(size_t n, unsigned flags) {
+    if (n == 0) n = 1;
+    int idx = class_index(n);
+    if (idx < 0) return big_alloc(n, flags);
 
-        cache_unlink(c, slab);
+    void *obj = cache_alloc(&caches[idx]);
+    if (obj && (flags & KM_ZERO)) zero_fill(obj, n);
+    return obj;
+}
 
-        uint32_t idxobj = slab_ptr_to_index(slab, p);
-        assert(idxobj < slab->total);
+/* ========= 释放 ========= */
+/* 要还的指针在 slab 里的下标；不是对象起始地址就停下 */
+static uint32_t obj_index(struct slub_slab *slab, void *p) {
+    assert(slab->magic == SLAB_MAGIC);
+    uint32_t idxobj = slab_ptr_to_index(slab, p);
+    if ((uintptr_t)p < slab->base || idxobj >= slab->total || slab_index_to_ptr(slab, idxobj) != p) {
+        cprintf("[slub] E: free(%p): not the start of an object (class=%u)\n", p,
+                (unsigned)slab->cache->obj_size);
+        assert(0);
+    }
+    return idxobj;
+}
 
-        uint32_t *slot = (uint32_t *)p;
-        *slot = slab->free_head;
-        slab->free_head = idxobj;
-        assert(slab->inuse > 0);
-        slab->inuse--;
+static void cache_free(struct slub_slab *slab, void *p) {
+    struct kmem_cache *c = slab->cache;
+    uint32_t idxobj = obj_index(slab, p);
 
-        if (slab->inuse == 0) slab_destroy(slab);
-        else                  cache_push_partial(c, slab);
+#if SLUB_CPU_CACHE
+    struct kmem_cache_cpu *cc = this_cpu(c);
+    if (slab == cc->slab) {
+        *obj_free_slot(c, p) = cc->free_head;
+        cc->free_head = idxobj;
+        cc->nfree++;
+        cc->free_fast++;
         return;
     }
-
-    /* 页首是大块头（兼容路径） */
-    struct big_hdr *h0 = (struct big_hdr *)base;
-    if (h0->magic == BIG_MAGIC && h0->guard == BIG_FOOT_MAGIC) {
-        big_free_by_hdr(h0);
+    /* 冻结在别的 hart 上：进它的远端队列。读到的 owner 可能刚解冻，对象晚些由它走锁路径还 */
+    uint16_t owner = __atomic_load_n(&slab->frozen, __ATOMIC_ACQUIRE);
+    if (owner != 0) {
+        remote_push(c, &c->cpu[owner - 1], p, p);
+        cc->free_remote++;
         return;
     }
+    cc->free_slow++;
+#else
+    this_cpu(c)->free_slow++;
+#endif
+    spin_lock(&c->lock);
+    slab_free_locked(c, slab, idxobj);
+    spin_unlock(&c->lock);
+}
 
-    cprintf("[slub] E: slub_free classify fail p=%p base=%p\n", p, base);
+/* 页标志对不上：说清楚是哪种错用，然后停下 */
+static void bad_pointer(const char *who, void *p, struct Page *pg) {
+    if (PageLarge(pg)) {
+        struct Page *head = (struct Page *)pg->page_link.next;
+        cprintf("[slub] E: %s(%p): %lu bytes into a %u-page allocation\n", who, p,
+                (unsigned long)((uintptr_t)p - (uintptr_t)page_to_kva(head)), head->property);
+    } else {
+        cprintf("[slub] E: %s(%p): not allocated by slub (page flags=0x%lx)\n", who, p,
+                (unsigned long)pg->flags);
+    }
     assert(0);
 }
 
+void slub_free(void *p) {
+    if (!p) return;
+
+    struct Page *pg = kva_to_page(p);
+    if (PageSlab(pg)) {
+        cache_free((struct slub_slab *)pg->page_link.next, p);
+    } else if (PageLarge(pg) && (struct Page *)pg->page_link.next == pg && page_to_kva(pg) == p) {
+        big_free(pg);
+    } else {
+        bad_pointer("kfree", p, pg);
+    }
+}
+
+/* ========= 可用大小 ========= */
+size_t slub_ksize(void *p) {
+    if (!p) return 0;
+    struct Page *pg = kva_to_page(p);
+    if (PageSlab(pg)) return ((struct slub_slab *)pg->page_link.next)->cache->obj_size;
+    if (!PageLarge(pg) || (struct Page *)pg->page_link.next != pg || page_to_kva(pg) != p)
+        bad_pointer("ksize", p, pg);
+    return (size_t)pg->property * PGSIZE;
+}
+
 /* ========= 适配 kmalloc/kfree ========= */
 void *kmalloc(size_t n) { return slub_alloc(n); }
-void *kzalloc(size_t n) { void *p = slub_alloc(n); if (p) memset(p, 0, n); return p; }
+void *kmalloc_flags(size_t n, unsigned flags) { return slub_alloc_flags(n, flags); }
+void *kzalloc(size_t n) { return slub_alloc_flags(n, KM_ZERO); }
 void  kfree(void *p)    { slub_free(p); }
+size_t ksize(void *p)   { return slub_ksize(p); }
 
-/* ========= 统计 / 自检 ========= */
-static int count_list(struct slub_slab *s){ int n=0; while(s){ n++; s=s->next; } return n; }
+/* ========= 批量 ========= */
+/*
+ * 先用完本 hart 冻结 slab 的私有链；不够时只拿一次 c->lock，按 partial、empty、新建的顺序
+ * 把一个个 slab 的 free-list 整条取空，每个 slab 只挪一次链。
+ */
+static size_t cache_alloc_bulk(struct kmem_cache *c, size_t count, void **out) {
+    size_t got = 0;
+#if SLUB_CPU_CACHE
+    struct kmem_cache_cpu *cc = this_cpu(c);
+    if (cc->free_head == SLUB_NIL && __atomic_load_n(&cc->remote, __ATOMIC_RELAXED) != NULL)
+        cpu_drain_remote(c, cc);
+    while (got < count && cc->free_head != SLUB_NIL) {
+        void *obj = slab_index_to_ptr(cc->slab, cc->free_head);
+        cc->free_head = *obj_free_slot(c, obj);
+        cc->nfree--;
+        out[got++] = obj;
+    }
+    cc->alloc_fast += got;
+    if (got == count) return got;
+#endif
+    size_t fast = got;
+    spin_lock(&c->lock);
+    while (got < count) {
+        struct slub_slab *s = cache_slab_with_space(c);
+        if (!s) break;
+        assert(s->free_head != SLUB_NIL);
+        while (got < count && s->free_head != SLUB_NIL) {
+            void *obj = slab_index_to_ptr(s, s->free_head);
+            s->free_head = *obj_free_slot(c, obj);
+            s->inuse++;
+            out[got++] = obj;
+        }
+        slab_place(c, s);
+    }
+    this_cpu(c)->alloc_slow += got - fast;
+    spin_unlock(&c->lock);
+    return got;
+}
+
+/*
+ * 同一 slab 的 cnt 个对象，已经按 free-list 的格式从 head 串到 tail（下标）：
+ * 本 hart 冻结的 slab 整串接到私有链，没冻结的拿一次锁接到 slab 的 free-list、最多挪一次链，都是 O(1)；
+ * 冻结在别处的改成远端链接，一次 CAS 进它的远端队列。
+ */
+static void slab_free_chain(struct slub_slab *slab, uint32_t head, uint32_t tail, size_t cnt) {
+    struct kmem_cache *c = slab->cache;
+    uint32_t *tail_slot = obj_free_slot(c, slab_index_to_ptr(slab, tail));
+#if SLUB_CPU_CACHE
+    struct kmem_cache_cpu *cc = this_cpu(c);
+    if (slab == cc->slab) {
+        *tail_slot = cc->free_head;
+        cc->free_head = head;
+        cc->nfree += cnt;
+        cc->free_fast += cnt;
+        return;
+    }
+    uint16_t owner = __atomic_load_n(&slab->frozen, __ATOMIC_ACQUIRE);
+    if (owner != 0) {
+        for (uint32_t idx = head; idx != SLUB_NIL; ) {
+            void *p = slab_index_to_ptr(slab, idx);
+            idx = idx == tail ? SLUB_NIL : *obj_free_slot(c, p);
+            *obj_remote_link(c, p) = idx == SLUB_NIL ? NULL : slab_index_to_ptr(slab, idx);
+        }
+        remote_push(c, &c->cpu[owner - 1], slab_index_to_ptr(slab, head), slab_index_to_ptr(slab, tail));
+        cc->free_remote += cnt;
+        return;
+    }
+    cc->free_slow += cnt;
+#else
+    this_cpu(c)->free_slow += cnt;
+#endif
+    spin_lock(&c->lock);
+    *tail_slot = slab->free_head;
+    slab->free_head = head;
+    assert(slab->inuse >= cnt);
+    slab->inuse -= cnt;
+    if (!slab->frozen) {
+        if (slab->inuse == 0)                slab_retire(c, slab);
+        else if (slab->state == SLAB_FULL)   slab_set_state(c, slab, SLAB_PARTIAL);
+    }
+    spin_unlock(&c->lock);
+}
+
+size_t kmalloc_bulk(size_t n, size_t count, void **out) {
+    if (n == 0) n = 1;
+    int idx = class_index(n);
+    if (idx >= 0) return cache_alloc_bulk(&caches[idx], count, out);
+
+    size_t got = 0;
+    while (got < count && (out[got] = big_alloc(n, 0)) != NULL) got++;
+    return got;
+}
+
+/*
+ * kfree_bulk 按 slab 分桶：slab -> 桶号走开放寻址的哈希表，最多分 BULK_GROUPS 个桶，
+ * 每个桶直接把对象串成 free-list 格式的一串（下标链）。
+ */
+#ifndef BULK_SHIFT
+#define BULK_SHIFT 6                            /* 桶号存在 uint8_t 里，最大 8 */
+#endif
+#define BULK_SLOTS  (1u << BULK_SHIFT)
+#define BULK_GROUPS (BULK_SLOTS / 2)
+#ifndef BULK_MIN_OBJS
+#define BULK_MIN_OBJS 8                         /* 一个 slab 装不到这么多对象就不分桶 */
+#endif
+
+struct bulk_groups {
+    uint8_t slot[BULK_SLOTS];                   /* 槽 -> 桶号，0xff 为空 */
+    struct slub_slab *slab[BULK_GROUPS];
+    uint32_t head[BULK_GROUPS], tail[BULK_GROUPS], cnt[BULK_GROUPS];
+    size_t ng;
+};
+
+/* slab 的桶号；没见过的 slab 开新桶，桶用完了返回 BULK_GROUPS */
+static size_t bulk_group(struct bulk_groups *g, struct slub_slab *slab) {
+    size_t h = (size_t)(((uint64_t)(uintptr_t)slab * 0x9E3779B97F4A7C15ull) >> (64 - BULK_SHIFT));
+    for (; g->slot[h] != 0xff; h = (h + 1) & (BULK_SLOTS - 1))
+        if (g->slab[g->slot[h]] == slab) return g->slot[h];
+    if (g->ng == BULK_GROUPS) return BULK_GROUPS;
+    size_t b = g->ng++;
+    g->slot[h] = (uint8_t)b;
+    g->slab[b] = slab;
+    g->head[b] = SLUB_NIL;
+    g->cnt[b] = 0;
+    return b;
+}
+
+/*
+ * 一趟过一遍：不在 slab 里的当场还掉，slab 里的挂到所属桶的串上，过完每个桶的串一次还掉。
+ * 分不进桶的（slab 装不到 BULK_MIN_OBJS 个对象，或者桶已经用完）当场走 cache_free 逐个还，
+ * 不再为它们多扫一趟，整批始终是 O(count)，最差也就是逐个 kfree 的开销。
+ */
+void kfree_bulk(void **ptrs, size_t count) {
+    struct bulk_groups g;
+    memset(g.slot, 0xff, sizeof(g.slot));
+    g.ng = 0;
+    struct slub_slab *last_slab = NULL;
+    size_t b = 0;
+    for (size_t i = 0; i < count; ++i) {
+        void *p = ptrs[i];
+        if (!p) continue;
+        ptrs[i] = NULL;
+        struct Page *pg = kva_to_page(p);
+        if (!PageSlab(pg)) {
+            slub_free(p);
+            continue;
+        }
+        struct slub_slab *slab = (struct slub_slab *)pg->page_link.next;
+        if (slab != last_slab) {
+            /* 只装几个对象的 slab 串起来省不了什么；桶满后也不再查表，查不中的探测分支猜不准，比逐个还还贵 */
+            b = slab->total >= BULK_MIN_OBJS && g.ng < BULK_GROUPS ? bulk_group(&g, slab) : BULK_GROUPS;
+            last_slab = slab;
+        }
+        if (b == BULK_GROUPS) {
+            cache_free(slab, p);
+            continue;
+        }
+        uint32_t idx = obj_index(slab, p);
+        *obj_free_slot(slab->cache, p) = g.head[b];
+        if (g.head[b] == SLUB_NIL) g.tail[b] = idx;
+        g.head[b] = idx;
+        g.cnt[b]++;
+    }
+    for (b = 0; b < g.ng; ++b)
+        slab_free_chain(g.slab[b], g.head[b], g.tail[b], g.cnt[b]);
+}
+
+/* ========= 专用 cache ========= */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+                                     void (*ctor)(void *)) {
+    if (align == 0) align = SLUB_ALIGN;
+    if (!name || size == 0 || (align & (align - 1)) || align > PGSIZE) return NULL;
+    if (align < SLUB_ALIGN) align = SLUB_ALIGN;
+
+    spin_lock(&cache_cache.lock);
+    struct kmem_cache *c = cache_alloc_locked(&cache_cache);
+    spin_unlock(&cache_cache.lock);
+    if (!c) return NULL;
+
+    if (!cache_init(c, name, size, align, ctor, 1)) {
+        cprintf("[slub] E: kmem_cache_create(%s): size=%u does not fit an order-%u slab\n",
+                name, (unsigned)size, (unsigned)SLUB_SLAB_MAX_ORDER);
+        spin_lock(&cache_cache.lock);
+        struct slub_slab *cs = obj_to_slab(c);
+        slab_free_locked(&cache_cache, cs, slab_ptr_to_index(cs, c));
+        spin_unlock(&cache_cache.lock);
+        return NULL;
+    }
+
+    spin_lock(&slub_lock);
+    list_add_before(&cache_cache.list, &c->list);
+    spin_unlock(&slub_lock);
+    return c;
+}
+
+int kmem_cache_destroy(struct kmem_cache *c) {
+    if (!c) return 0;
+    assert(c->name != NULL && c != &cache_cache && c != &slab_meta);
+
+    for (int h = 0; h < NR_HARTS; ++h) cpu_flush(c, &c->cpu[h]);
+    spin_lock(&c->lock);
+    cache_shrink_locked(c, 0);
+    size_t busy = c->nr_slabs[SLAB_PARTIAL] + c->nr_slabs[SLAB_FULL];
+    spin_unlock(&c->lock);
+    if (busy) {
+        cprintf("[slub] E: kmem_cache_destroy(%s): %lu slabs still in use\n",
+                c->name, (unsigned long)busy);
+        return -1;
+    }
 
+    spin_lock(&slub_lock);
+    list_del(&c->list);
+    spin_unlock(&slub_lock);
+
+    spin_lock(&cache_cache.lock);
+    struct slub_slab *cs = obj_to_slab(c);
+    slab_free_locked(&cache_cache, cs, slab_ptr_to_index(cs, c));
+    spin_unlock(&cache_cache.lock);
+    return 0;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *c) {
+    return cache_alloc(c);
+}
+
+void kmem_cache_free(struct kmem_cache *c, void *p) {
+    if (!p) return;
+    struct slub_slab *slab = obj_to_slab(p);
+    if (!slab || slab->cache != c) {
+        cprintf("[slub] E: kmem_cache_free(%s): p=%p not from this cache\n", c->name, p);
+        assert(0);
+    }
+    cache_free(slab, p);
+}
+
+size_t kmem_cache_size(struct kmem_cache *c) {
+    return c->obj_size;
+}
+
+/* ========= 每 hart 缓存的归还 ========= */
+void slub_flush_cpu(void) {
+    struct kmem_cache *c;
+    spin_lock(&slub_lock);
+    for_each_cache(c) cpu_flush(c, this_cpu(c));
+    spin_unlock(&slub_lock);
+}
+
+void slub_flush_all(void) {
+    struct kmem_cache *c;
+    spin_lock(&slub_lock);
+    for_each_cache(c)
+        for (int h = 0; h < NR_HARTS; ++h) cpu_flush(c, &c->cpu[h]);
+    spin_unlock(&slub_lock);
+}
+
+/* ========= 空 slab 回收 ========= */
+size_t slub_shrink(int all) {
+    size_t n = 0;
+    struct kmem_cache *c;
+    spin_lock(&slub_lock);
+    for_each_cache(c) {
+        spin_lock(&c->lock);
+        n += cache_shrink_locked(c, all ? 0 : c->empty_min);
+        spin_unlock(&c->lock);
+    }
+    spin_unlock(&slub_lock);
+    return n;
+}
+
+/*
+ * slab_create 持着 c->lock 时调用：slub_lock 和别的 cache 都只 trylock，拿不到就跳过，不和对方互等。
+ * slab_meta 自己缺页时不碰页外头的 cache——拆它们的 slab 要回头拿 slab_meta.lock。
+ */
+static size_t cache_shrink_others(struct kmem_cache *c) {
+    size_t n = 0;
+    struct kmem_cache *o;
+    if (!spin_trylock(&slub_lock)) return 0;
+    for_each_cache(o) {
+        if (o == c || (c == &slab_meta && o->off_slab)) continue;
+        if (!spin_trylock(&o->lock)) continue;
+        n += cache_shrink_locked(o, 0);
+        spin_unlock(&o->lock);
+    }
+    spin_unlock(&slub_lock);
+    return n;
+}
+
+void slub_set_empty_limits(size_t min, size_t max) {
+    struct kmem_cache *c;
+    if (min > max) min = max;
+    spin_lock(&slub_lock);
+    for_each_cache(c) {
+        if (c == &cache_cache || c == &slab_meta) continue;
+        spin_lock(&c->lock);
+        c->empty_min = objs_to_slabs(c, min);
+        c->empty_max = objs_to_slabs(c, max);
+        cache_shrink_locked(c, c->empty_max);
+        spin_unlock(&c->lock);
+    }
+    spin_unlock(&slub_lock);
+}
+
+/* ========= 统计 / 自检 ========= */
 void slub_dump_stats(int verbose) {
+    struct kmem_cache *c;
     cprintf("[slub] stats\n");
-    for (int i = 0; i < N_CACHES; ++i) {
-        struct kmem_cache *c = &caches[i];
-        int n_partial = count_list(c->partial);
-        int n_full    = count_list(c->full);
+    spin_lock(&slub_lock);
+    for_each_cache(c) {
+        int n_partial = (int)c->nr_slabs[SLAB_PARTIAL];
+        int n_full    = (int)c->nr_slabs[SLAB_FULL];
+        int n_empty   = (int)c->nr_slabs[SLAB_EMPTY];
 
+        /* 内存紧时退阶建的 slab 对象数不同，full 也逐个累加 */
         uint64_t inuse=0, total=0;
-        for(struct slub_slab *s=c->full; s; s=s->next){ inuse+=s->total; total+=s->total; }
-        for(struct slub_slab *s=c->partial; s; s=s->next){ inuse+=s->inuse; total+=s->total; }
+        list_entry_t *le;
+        for(int st=SLAB_PARTIAL; st<=SLAB_FULL; ++st){
+            for(le=list_next(&c->lists[st]); le!=&c->lists[st]; le=list_next(le)){
+                struct slub_slab *s=le2slab(le); inuse+=s->inuse; total+=s->total;
+            }
+        }
+
+        /* 冻结的 slab：私有链上的不算在用；别的 hart 正在跑时只是个近似值 */
+        int n_cpu = 0;
+        size_t af=0, as=0, ff=0, fr=0, fs=0, rd=0;
+        for(int h=0; h<NR_HARTS; ++h){
+            struct kmem_cache_cpu *cc=&c->cpu[h];
+            if(cc->slab){ n_cpu++; inuse+=cc->slab->inuse-cc->nfree; total+=cc->slab->total; }
+            af+=cc->alloc_fast; as+=cc->alloc_slow;
+            ff+=cc->free_fast; fr+=cc->free_remote; fs+=cc->free_slow; rd+=cc->remote_drained;
+        }
 
         uint64_t bytes_req = inuse * c->obj_size;
-        uint64_t bytes_cap = (uint64_t)(n_full+n_partial) * (c->objs_per_slab * c->obj_stride);
+        uint64_t bytes_cap = total * c->obj_stride;
+        total += (uint64_t)n_empty * c->objs_per_slab;
         uint64_t internal_frag = bytes_cap>bytes_req? (bytes_cap - bytes_req):0;
 
-        cprintf("  class=%4u stride=%4u slab(partial=%d, full=%d) objs inuse=%llu/%llu, internal_frag=%lluB\n",
-            (unsigned)c->obj_size, (unsigned)c->obj_stride, n_partial, n_full,
+        /* 版式：slab 几页、头放哪、一个 slab 几个对象、整 slab 有多少不是对象 */
+        size_t waste = slab_waste_permille(c, c->order);
+        if (c->name) cprintf("  %-14s", c->name);
+        else         cprintf("  kmalloc-%-6u", (unsigned)c->obj_size);
+        cprintf(" size=%4u stride=%4u align=%u order=%u %s objs/slab=%u waste=%u.%u%%%s\n",
+            (unsigned)c->obj_size, (unsigned)c->obj_stride, (unsigned)c->align, c->order,
+            c->off_slab ? "off-slab" : "on-slab", (unsigned)c->objs_per_slab,
+            (unsigned)(waste / 10), (unsigned)(waste % 10),
+            c->ctor ? " ctor" : "");
+        cprintf("    slab(partial=%d, full=%d, empty=%d, cpu=%d) objs inuse=%llu/%llu, internal_frag=%lluB\n",
+            n_partial, n_full, n_empty, n_cpu,
             (unsigned long long)inuse, (unsigned long long)total,
             (unsigned long long)internal_frag);
+        if (SLUB_CPU_CACHE && (af || as || ff || fr || fs))
+            cprintf("    alloc fast=%lu slow=%lu  free fast=%lu remote=%lu slow=%lu  remote drained=%lu\n",
+                (unsigned long)af, (unsigned long)as, (unsigned long)ff,
+                (unsigned long)fr, (unsigned long)fs, (unsigned long)rd);
+        /* 每千次分配建/拆多少个 slab，衡量页来回抖动的程度 */
+        if (c->slab_creates || c->slab_destroys) {
+            size_t allocs = af + as;
+            cprintf("    slabs created=%lu destroyed=%lu (%lu/%lu per 1k allocs) empty reused=%lu shrunk=%lu\n",
+                (unsigned long)c->slab_creates, (unsigned long)c->slab_destroys,
+                (unsigned long)(allocs ? c->slab_creates * 1000 / allocs : 0),
+                (unsigned long)(allocs ? c->slab_destroys * 1000 / allocs : 0),
+                (unsigned long)c->empty_reuses, (unsigned long)c->shrunk);
+        }
 
         if(verbose){
-            for(struct slub_slab *s=c->partial; s; s=s->next){
+            for(le=list_next(&c->lists[SLAB_PARTIAL]); le!=&c->lists[SLAB_PARTIAL]; le=list_next(le)){
+                struct slub_slab *s=le2slab(le);
                 cprintf("    [partial] inuse=%u total=%u free_head=%u\n", s->inuse, s->total, s->free_head);
             }
         }
     }
+    spin_unlock(&slub_lock);
     cprintf("[slub] stats end\n");
 }
 
-/* Floyd 防环，避免自检卡死 */
-static int list_has_cycle(struct slub_slab *head){
-    struct slub_slab *slow=head, *fast=head;
-    while (fast && fast->next){
-        slow = slow->next;
-        fast = fast->next->next;
-        if (slow == fast) return 1;
-    }
-    return 0;
-}
+static const char *const state_name[SLAB_NSTATES] = {"PARTIAL", "FULL", "EMPTY"};
 
-/* 一致性检查：带防环与长度护栏 */
+/* 一致性检查：双向链前后指针互指、长度与 nr_slabs 一致，带长度护栏 */
 int slub_check_invariants(int fatal){
     int bad=0;
-    const int GUARD_MAX=100000;
-    for (int i=0;i<N_CACHES;++i){
-        struct kmem_cache *c=&caches[i];
+    const size_t GUARD_MAX=100000;
+    struct kmem_cache *c;
+    spin_lock(&slub_lock);
+    for_each_cache(c){
 
-        if (list_has_cycle(c->partial)){
-            cprintf("[slub] E: cycle in PARTIAL list (class=%u)\n",(unsigned)c->obj_size);
-            if (fatal) assert(0); return 0;
-        }
-        if (list_has_cycle(c->full)){
-            cprintf("[slub] E: cycle in FULL list (class=%u)\n",(unsigned)c->obj_size);
-            if (fatal) assert(0); return 0;
+        for(int st=0; st<SLAB_NSTATES; ++st){
+            list_entry_t *head=&c->lists[st], *le=head;
+            size_t n=0;
+            while((le=list_next(le))!=head){
+                if(list_prev(list_next(le))!=le){ cprintf("[slub] E: broken %s list (class=%u)\n",state_name[st],(unsigned)c->obj_size); if(fatal) assert(0); spin_unlock(&slub_lock); return 0; }
+                if(++n>GUARD_MAX){ cprintf("[slub] E: %s too long (class=%u)\n",state_name[st],(unsigned)c->obj_size); if(fatal) assert(0); spin_unlock(&slub_lock); return 0; }
+                struct slub_slab *s=le2slab(le);
+                if(s->state!=st || s->cache!=c){ cprintf("[slub] E: slab on %s has state=%u (class=%u)\n",state_name[st],s->state,(unsigned)c->obj_size); if(fatal) assert(0); bad=1; }
+                if(s->frozen){ cprintf("[slub] E: frozen slab on %s (class=%u)\n",state_name[st],(unsigned)c->obj_size); if(fatal) assert(0); bad=1; }
+                for(size_t pi=0; pi<((size_t)1<<s->order); ++pi){
+                    if(obj_to_slab((void *)(ROUNDDOWN(s->base,PGSIZE)+pi*PGSIZE))!=s){ cprintf("[slub] E: page %lu of slab not mapped back (class=%u)\n",(unsigned long)pi,(unsigned)c->obj_size); if(fatal) assert(0); bad=1; break; }
+                }
+                int want = s->inuse==0 ? SLAB_EMPTY : s->inuse<s->total ? SLAB_PARTIAL : SLAB_FULL;
+                if(want!=st){ cprintf("[slub] E: %s slab inuse=%u total=%u (class=%u)\n",state_name[st],s->inuse,s->total,(unsigned)c->obj_size); if(fatal) assert(0); bad=1; }
+                uint32_t seen=0, idx=s->free_head;
+                while(idx!=SLUB_NIL){
+                    if(idx>=s->total){ cprintf("[slub] E: bad idx=%u total=%u\n",idx,s->total); if(fatal) assert(0); bad=1; break; }
+                    idx=*obj_free_slot(c, slab_index_to_ptr(s, idx));
+                    if(++seen> s->total){ cprintf("[slub] E: free list loop\n"); if(fatal) assert(0); bad=1; break; }
+                }
+                if(seen!=(uint32_t)(s->total-s->inuse)){ cprintf("[slub] E: free list has %u, expect %u (class=%u)\n",seen,s->total-s->inuse,(unsigned)c->obj_size); if(fatal) assert(0); bad=1; }
+            }
+            if(st==SLAB_EMPTY && n>c->empty_max){ cprintf("[slub] E: %lu empty slabs > max %lu (class=%u)\n",(unsigned long)n,(unsigned long)c->empty_max,(unsigned)c->obj_size); if(fatal) assert(0); bad=1; }
+            if(n!=c->nr_slabs[st]){ cprintf("[slub] E: %s count %lu != nr_slabs %lu (class=%u)\n",state_name[st],(unsigned long)n,(unsigned long)c->nr_slabs[st],(unsigned)c->obj_size); if(fatal) assert(0); bad=1; }
         }
-
-        int guard=0;
-        for(struct slub_slab *s=c->partial; s; s=s->next){
-            if(++guard>GUARD_MAX){ cprintf("[slub] E: partial too long (class=%u)\n",(unsigned)c->obj_size); if(fatal) assert(0); bad=1; break; }
-            if(!(s->inuse<=s->total)){ cprintf("[slub] E: inuse>total (class=%u)\n",(unsigned)c->obj_size); if(fatal) assert(0); bad=1; }
-            uint32_t seen=0, idx=s->free_head;
+        /* 每 hart 缓存：只在别的 hart 不动 kmalloc 时才准 */
+        for(int h=0; h<NR_HARTS; ++h){
+            struct kmem_cache_cpu *cc=&c->cpu[h];
+            struct slub_slab *s=cc->slab;
+            if(!s){
+                if(cc->free_head!=SLUB_NIL || cc->nfree){ cprintf("[slub] E: cpu%d free-list without slab (class=%u)\n",h,(unsigned)c->obj_size); if(fatal) assert(0); bad=1; }
+                continue;
+            }
+            if(s->frozen!=h+1 || s->cache!=c || s->state!=SLAB_DETACHED){ cprintf("[slub] E: cpu%d slab not frozen here (class=%u)\n",h,(unsigned)c->obj_size); if(fatal) assert(0); bad=1; }
+            uint32_t seen=0, idx=cc->free_head;
             while(idx!=SLUB_NIL){
-                if(idx>=s->total){ cprintf("[slub] E: bad idx=%u total=%u\n",idx,s->total); if(fatal) assert(0); bad=1; break; }
-                void *p=slab_index_to_ptr(s, idx);
-                idx=*(uint32_t*)p;
-                if(++seen> s->total){ cprintf("[slub] E: free list loop\n"); if(fatal) assert(0); bad=1; break; }
+                if(idx>=s->total || ++seen>s->total){ cprintf("[slub] E: cpu%d bad free-list (class=%u)\n",h,(unsigned)c->obj_size); if(fatal) assert(0); bad=1; break; }
+                idx=*obj_free_slot(c, slab_index_to_ptr(s, idx));
             }
-        }
-        guard=0;
-        for(struct slub_slab *s=c->full; s; s=s->next){
-            if(++guard>GUARD_MAX){ cprintf("[slub] E: full too long (class=%u)\n",(unsigned)c->obj_size); if(fatal) assert(0); bad=1; break; }
-            if(!(s->inuse==s->total)){ cprintf("[slub] E: full but inuse!=total (class=%u)\n",(unsigned)c->obj_size); if(fatal) assert(0); bad=1; }
+            if(seen!=cc->nfree || cc->nfree>s->inuse){ cprintf("[slub] E: cpu%d nfree=%u counted=%u inuse=%u (class=%u)\n",h,cc->nfree,seen,s->inuse,(unsigned)c->obj_size); if(fatal) assert(0); bad=1; }
         }
     }
+    spin_unlock(&slub_lock);
     if(!bad) cprintf("[slub] invariants ok\n");
     return !bad;
 }
@@ -10,22 +10,70 @@ typedef unsigned short uint16_t;
 typedef unsigned int   uint32_t;
 #endif
 
+/* 分配标志 */
+#define KM_ZERO 0x1u    /* 返回前清零；大块直接取预清零的页 */
+
 /* 对外接口 */
 void  slub_init(void);
+/* 超过最大 class（2048B）的请求按整页分配，返回页对齐的地址，不带头 */
 void* slub_alloc(size_t n);
+void* slub_alloc_flags(size_t n, unsigned flags);
 void  slub_free(void *p);
+/* p 实际可用的字节数（所在 cache 的对象大小，大块为整页） */
+size_t slub_ksize(void *p);
 
 static inline void *slub_zalloc(size_t n) {
-    void *p = slub_alloc(n);
-    if (p) memset(p, 0, n);
-    return p;
+    return slub_alloc_flags(n, KM_ZERO);
 }
 
+/*
+ * 专用 cache：对象按自己的大小和对齐排，不向上取整到 kmalloc 的 class。
+ * ctor 在新建 slab 时对每个对象调一次（持着该 cache 的锁，里面不能再用同一个 cache）；
+ * free 不碰对象内容，下次 alloc 拿到的仍是构造好的状态，所以 free 前要把对象恢复成构造后的样子。
+ * name 不复制，须一直有效；align 为 0 按 8 字节，须是 2 的幂且不超过 PGSIZE。
+ * 对象也可以直接 kfree。
+ */
+struct kmem_cache;
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+                                     void (*ctor)(void *));
+/* 还有对象没 free 时返回 -1，cache 照常可用；调用者保证别的 hart 不再用它 */
+int   kmem_cache_destroy(struct kmem_cache *c);
+void *kmem_cache_alloc(struct kmem_cache *c);
+void  kmem_cache_free(struct kmem_cache *c, void *p);
+/* 创建时给的对象大小 */
+size_t kmem_cache_size(struct kmem_cache *c);
+
+/*
+ * 把每 hart 冻结的 slab 和远端释放队列还回 cache：flush_cpu 只管调用者自己的 hart，
+ * flush_all 管全部 hart，调用者保证此时别的 hart 不在 kmalloc/kfree 里。
+ * 想让 nr_free_pages 回到分配前的值（基准、自检）时先 flush_all 再 slub_shrink(1)。
+ */
+void  slub_flush_cpu(void);
+void  slub_flush_all(void);
+
+/*
+ * 各 cache（含专用 cache）保留的空 slab 还给 pmm：每个 cache 留 empty_min 个（下限折成的 slab 数），all 为真时一个不留。
+ * 返回还掉的页数。页分配失败时 slub 自己也会调；内存紧张的其他路径可以直接调。
+ */
+size_t slub_shrink(int all);
+/* 改所有 cache 的空 slab 保留下限/上限（按对象数，各 cache 折成 slab 数），超出上限的当场还掉 */
+void  slub_set_empty_limits(size_t min, size_t max);
+
 /* 统计与自检 */
 void slub_dump_stats(int verbose);
 int  slub_check_invariants(int fatal);
 
 /* 让全局 kmalloc/kfree 指到 SLUB */
 void *kmalloc(size_t n);
+void *kmalloc_flags(size_t n, unsigned flags);
 void *kzalloc(size_t n);
 void  kfree(void *p);
+size_t ksize(void *p);
+
+/*
+ * 批量：一次分配 count 个 n 字节的对象写入 out[]，返回实际分配到的个数（内存不够时少于 count）。
+ * kfree_bulk 按 slab 分组，每个 slab 的对象串成一串一起还（分不了组的逐个还，不会比逐个 kfree 慢），
+ * 可以混着不同大小、夹着 NULL；返回时 ptrs[] 全部置 NULL。
+ */
+size_t kmalloc_bulk(size_t n, size_t count, void **out);
+void   kfree_bulk(void **ptrs, size_t count);
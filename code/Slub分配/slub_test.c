@@ -3,6 +3,7 @@
 #include <string.h>
 #include "../mm/slub.h"
 #include "../mm/pmm.h"
+#include "../mm/zpool.h"
 
 static void fill(void *p, size_t n, uint8_t v){ memset(p, v, n); }
 
@@ -29,15 +30,18 @@ static void test_basic(void){
     cprintf("[T1] basic ok\n");
 }
 
-/* T2: 大块路径（>2KB 走页） */
+/* T2: 大块路径（>2KB 走页，页对齐） */
 static void test_big(void){
     cprintf("[T2] big begin\n");
     size_t sizes[] = { 2049, 3000, 4096, 6000, 8191, 16384 };
     void *p[16]={0};
     for(int i=0;i<6;++i){
         p[i]=kmalloc(sizes[i]);
-        assert(p[i]);
+        /* 不带头：整页对齐，正好 ceil(n/PGSIZE) 页 */
+        assert(p[i] && ((uintptr_t)p[i] & (PGSIZE-1))==0);
+        assert(ksize(p[i])==(sizes[i]+PGSIZE-1)/PGSIZE*PGSIZE);
         ((uint8_t*)p[i])[0]=0x5A;
+        ((uint8_t*)p[i])[sizes[i]-1]=0x5A;
     }
     for(int i=0;i<6;++i) kfree(p[i]);
     slub_check_invariants(1);
@@ -60,12 +64,12 @@ static void test_fragmentation_snapshot(void){
     for(int i=0;i<2000; i+=2) { kfree(g_a[i]); g_a[i]=NULL; }
     slub_dump_stats(1);                // 查看 partial 细节
 
-    /* 再分配 1000 个 129B（跨到 256-class） */
+    /* 再分配 1000 个 129B（跨到下一档，默认 class 表里是 192） */
     for(int i=0;i<1000;++i){
         g_b[i]=kmalloc(129);
-        assert(g_b[i]!=NULL);
+        assert(g_b[i]!=NULL && ksize(g_b[i])>=129);
     }
-    slub_dump_stats(0);                // 128+256 混合
+    slub_dump_stats(0);                // 128+192 混合
 
     /* 全部回收并校验 */
     for(int i=0;i<2000;++i) if(g_a[i]) kfree(g_a[i]), g_a[i]=NULL;
@@ -110,10 +114,129 @@ static void test_pattern_showcase(void){
     cprintf("[T4] pattern showcase ok\n");
 }
 
+/* T5: 清零分配：先弄脏再归还，kzalloc/alloc_pages_zeroed 拿回来必须全 0；对比池空与池满的耗时 */
+static inline uint64_t rdtime(void){ uint64_t t; asm volatile("rdtime %0" : "=r"(t)); return t; }
+
+static int all_zero(const void *p, size_t n){
+    const uint8_t *b=p;
+    for(size_t i=0;i<n;++i) if(b[i]) return 0;
+    return 1;
+}
+
+static void test_zeroed(void){
+    cprintf("[T5] zeroed begin\n");
+    size_t sizes[] = { 24, 2048, 3000, 8000, 16000 };
+    for(int i=0;i<5;++i){
+        void *d=kmalloc(sizes[i]); assert(d); fill(d, sizes[i], 0xCC); kfree(d);
+        void *z=kzalloc(sizes[i]); assert(z && all_zero(z, sizes[i])); kfree(z);
+    }
+    struct Page *pg=alloc_pages_zeroed(3);
+    assert(pg && all_zero((void *)(page2pa(pg) + va_pa_offset), 3 * PGSIZE));
+    free_pages(pg, 3);
+
+    const int N=8;                     // 16000B 落在 4 页块，默认池里正好 8 块
+    zpool_drain();
+    uint64_t t0=rdtime();
+    for(int i=0;i<N;++i){ g_b[i]=kzalloc(16000); assert(g_b[i]); }
+    uint64_t cold=rdtime()-t0;
+    for(int i=0;i<N;++i) kfree(g_b[i]);
+    zpool_refill((size_t)-1);
+    t0=rdtime();
+    for(int i=0;i<N;++i){ g_b[i]=kzalloc(16000); assert(g_b[i]); }
+    uint64_t warm=rdtime()-t0;
+    for(int i=0;i<N;++i) kfree(g_b[i]);
+    cprintf("  [T5] %d x kzalloc(16000): pool empty %lu ticks, pool filled %lu ticks\n",
+            N, (unsigned long)cold, (unsigned long)warm);
+    zpool_dump_stats();
+    slub_check_invariants(1);
+    cprintf("[T5] zeroed ok\n");
+}
+
+/* T6: 专用 cache：按 64B 对齐，ctor 只在建 slab 时跑，free 再 alloc 回来仍是构造好的样子 */
+struct t6_obj { uint32_t magic; uint32_t refs; uint8_t body[88]; };
+static int t6_ctor_calls;
+
+static void t6_ctor(void *p){
+    struct t6_obj *o=p;
+    o->magic=0x7E570B1Eu; o->refs=0;
+    memset(o->body, 0x3C, sizeof(o->body));
+    t6_ctor_calls++;
+}
+
+static void test_kmem_cache(void){
+    cprintf("[T6] kmem_cache begin\n");
+    struct kmem_cache *kc=kmem_cache_create("t6_obj", sizeof(struct t6_obj), 64, t6_ctor);
+    assert(kc && kmem_cache_size(kc)==sizeof(struct t6_obj));
+    const int N=300;
+    for(int i=0;i<N;++i){
+        struct t6_obj *o=kmem_cache_alloc(kc);
+        assert(o && ((uintptr_t)o & 63u)==0);
+        assert(o->magic==0x7E570B1Eu && o->refs==0 && o->body[0]==0x3C && o->body[87]==0x3C);
+        o->refs=1;                     // 用的时候改，free 前恢复
+        g_a[i]=o;
+    }
+    int calls=t6_ctor_calls;
+    assert(calls>=N);
+    for(int i=0;i<N;++i){ ((struct t6_obj *)g_a[i])->refs=0; kmem_cache_free(kc, g_a[i]); }
+    for(int i=0;i<N;++i){
+        struct t6_obj *o=kmem_cache_alloc(kc);
+        assert(o && o->magic==0x7E570B1Eu && o->refs==0 && o->body[87]==0x3C);
+        g_a[i]=o;
+    }
+    slub_dump_stats(0);
+    for(int i=0;i<N;++i) kfree(g_a[i]);          // kfree 也认专用 cache 的对象
+    /* ctor 次数跟着建 slab 的次数走，和 alloc 次数无关 */
+    cprintf("  [T6] ctor calls %d for %d allocs\n", t6_ctor_calls, 2*N);
+    assert(kmem_cache_destroy(kc)==0);
+    slub_check_invariants(1);
+    cprintf("[T6] kmem_cache ok\n");
+}
+
+/* T7: 批量分配/释放：T3 的 2000 个 128B 和 1000 个 129B 各一次调用拿到，再混在一起批量还 */
+static void test_bulk(void){
+    cprintf("[T7] bulk begin\n");
+    size_t got=kmalloc_bulk(128, 2000, g_a);
+    assert(got==2000);
+    for(int i=0;i<2000;++i){
+        assert(g_a[i] && (((uintptr_t)g_a[i] & 7u)==0) && ksize(g_a[i])>=128);
+        *(uint32_t *)g_a[i]=(uint32_t)i;
+    }
+    for(int i=0;i<2000;++i) assert(*(uint32_t *)g_a[i]==(uint32_t)i);   // 没有两个拿到同一块
+    got=kmalloc_bulk(129, 1000, g_b);
+    assert(got==1000);
+    slub_dump_stats(0);
+
+    /* 两个数组隔几个互换一项，再夹一个 NULL 和一个大块：不同 slab、不同大小混着也要都还对 */
+    for(int i=0;i<1000;i+=3){ void *t=g_a[2*i+1]; g_a[2*i+1]=g_b[i]; g_b[i]=t; }
+    kfree(g_a[0]); g_a[0]=NULL;
+    void *t=g_b[1]; g_b[1]=kmalloc(5000); assert(g_b[1]); kfree(t);
+    kfree_bulk(g_a, 2000);
+    kfree_bulk(g_b, 1000);
+    for(int i=0;i<2000;++i) assert(g_a[i]==NULL);
+    for(int i=0;i<1000;++i) assert(g_b[i]==NULL);
+    slub_check_invariants(1);
+
+    /* 按步长打乱，各 slab 的对象交错着还：256B 的 1000 个跨的 slab 比分桶多，桶外的逐个还；
+       2048B 一个 slab 只装两个，整批都不分桶 */
+    size_t bsz[] = { 256, 2048 };
+    for(int j=0;j<2;++j){
+        got=kmalloc_bulk(bsz[j], 1000, g_a);
+        assert(got==1000);
+        for(int i=0;i<1000;++i) g_b[i]=g_a[(i*7)%1000];
+        kfree_bulk(g_b, 1000);
+        for(int i=0;i<1000;++i){ assert(g_b[i]==NULL); g_a[i]=NULL; }
+        slub_check_invariants(1);
+    }
+    cprintf("[T7] bulk ok\n");
+}
+
 void run_slub_tests(void){
     test_basic();                  // T1
     test_big();                    // T2
     test_fragmentation_snapshot(); // T3
     test_pattern_showcase();       // T4
+    test_zeroed();                 // T5
+    test_kmem_cache();             // T6
+    test_bulk();                   // T7
     cprintf("[slub] all tests done\n");
 }
@@ -0,0 +1,158 @@
+#include <defs.h>
+#include <stdio.h>
+#include <list.h>
+#include <assert.h>
+#include "memlayout.h"
+#include "pmm.h"
+#include "spinlock.h"
+#include "zpool.h"
+
+/*
+ * 池按阶分表，第 k 阶放 2^k 页的已清零块，目标存量 ZPOOL_HIGH >> k 块，
+ * 默认 32/16/8/4 块，共 128 页（512KiB）。ZPOOL_HIGH 为 0 时不建池，alloc_pages_zeroed 总是当场清零。
+ * 块从 pmm 按不可移动类型取出（用户是 big_alloc、页表等内核长期对象），
+ * 在池里时已经算“已分配”，借 page_link 挂表；补充时分配与清零都在池锁外做，只有入表持锁。
+ */
+#ifndef ZPOOL_HIGH
+#define ZPOOL_HIGH 32
+#endif
+#define ZPOOL_ORDERS 4
+
+static struct {
+    spinlock_t   lock;
+    list_entry_t list[ZPOOL_ORDERS];
+    size_t       count[ZPOOL_ORDERS];
+    size_t       hits, misses, drains;
+    size_t       zeroed_idle;       /* 空闲时清零的页数 */
+    size_t       zeroed_sync;       /* 调用路径上当场清零的页数 */
+} zp;
+
+static inline void *zp_kva(struct Page *pg) {
+    return (void *)(page2pa(pg) + va_pa_offset);
+}
+
+static inline size_t zp_target(int k) {
+    return (size_t)ZPOOL_HIGH >> k;
+}
+
+/*
+ * 关掉 GCC 把清零循环识别成 memset 调用的优化：内核的 memset 是逐字节的，
+ * 那样反而绕回了慢路径。
+ */
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+void zero_fill(void *dst, size_t n) {
+    uint8_t *p = dst;
+    while (n > 0 && ((uintptr_t)p & 7)) {
+        *p++ = 0;
+        n--;
+    }
+    uint64_t *w = (uint64_t *)p;
+    for (; n >= 64; n -= 64, w += 8) {
+        w[0] = 0; w[1] = 0; w[2] = 0; w[3] = 0;
+        w[4] = 0; w[5] = 0; w[6] = 0; w[7] = 0;
+    }
+    for (; n >= 8; n -= 8) *w++ = 0;
+    p = (uint8_t *)w;
+    while (n-- > 0) *p++ = 0;
+}
+
+void zpool_init(void) {
+    spin_lock_init(&zp.lock);
+    for (int k = 0; k < ZPOOL_ORDERS; k++) {
+        list_init(&zp.list[k]);
+        zp.count[k] = 0;
+    }
+    zp.hits = zp.misses = zp.drains = 0;
+    zp.zeroed_idle = zp.zeroed_sync = 0;
+}
+
+size_t zpool_refill(size_t budget) {
+    size_t done = 0;
+    for (int k = 0; k < ZPOOL_ORDERS && done < budget; k++) {
+        while (done < budget && zp.count[k] < zp_target(k)) {
+            struct Page *pg = alloc_pages_mt((size_t)1 << k, MT_UNMOVABLE);
+            if (pg == NULL) return done;
+            zero_fill(zp_kva(pg), PGSIZE << k);
+            spin_lock(&zp.lock);
+            list_add(&zp.list[k], &(pg->page_link));
+            zp.count[k]++;
+            zp.zeroed_idle += (size_t)1 << k;
+            spin_unlock(&zp.lock);
+            done++;
+        }
+    }
+    return done;
+}
+
+void zpool_drain(void) {
+    for (int k = 0; k < ZPOOL_ORDERS; k++) {
+        spin_lock(&zp.lock);
+        while (!list_empty(&zp.list[k])) {
+            list_entry_t *le = list_next(&zp.list[k]);
+            list_del(le);
+            zp.count[k]--;
+            spin_unlock(&zp.lock);
+            free_pages(le2page(le, page_link), (size_t)1 << k);
+            spin_lock(&zp.lock);
+        }
+        if (k == 0) zp.drains++;
+        spin_unlock(&zp.lock);
+    }
+}
+
+static struct Page *zpool_pop(int k) {
+    struct Page *pg = NULL;
+    spin_lock(&zp.lock);
+    if (!list_empty(&zp.list[k])) {
+        list_entry_t *le = list_next(&zp.list[k]);
+        list_del(le);
+        zp.count[k]--;
+        zp.hits++;
+        pg = le2page(le, page_link);
+    }
+    spin_unlock(&zp.lock);
+    return pg;
+}
+
+static size_t zpool_cached(void) {
+    size_t pages = 0;
+    for (int k = 0; k < ZPOOL_ORDERS; k++) pages += zp.count[k] << k;
+    return pages;
+}
+
+/* 池里取能装下 n 页的最小阶块，多出的尾页直接还给 pmm */
+struct Page *alloc_pages_zeroed(size_t n) {
+    assert(n > 0);
+    int k = 0;
+    while (k < ZPOOL_ORDERS && ((size_t)1 << k) < n) k++;
+    if (ZPOOL_HIGH > 0 && k < ZPOOL_ORDERS) {
+        struct Page *pg = zpool_pop(k);
+        if (pg != NULL) {
+            if (n < ((size_t)1 << k)) free_pages(pg + n, ((size_t)1 << k) - n);
+            return pg;
+        }
+    }
+
+    struct Page *pg = alloc_pages_mt(n, MT_UNMOVABLE);
+    if (pg == NULL && zpool_cached() > 0) {
+        zpool_drain();
+        pg = alloc_pages_mt(n, MT_UNMOVABLE);
+    }
+    if (pg == NULL) return NULL;
+    zero_fill(zp_kva(pg), n * PGSIZE);
+    spin_lock(&zp.lock);
+    zp.misses++;
+    zp.zeroed_sync += n;
+    spin_unlock(&zp.lock);
+    return pg;
+}
+
+void zpool_dump_stats(void) {
+    cprintf("[zpool] cached=%lu pages (", (unsigned long)zpool_cached());
+    for (int k = 0; k < ZPOOL_ORDERS; k++) {
+        cprintf("%s%lux%lu", k ? " " : "", (unsigned long)zp.count[k], 1UL << k);
+    }
+    cprintf(") hits=%lu misses=%lu drains=%lu zeroed idle=%lu sync=%lu pages\n",
+            (unsigned long)zp.hits, (unsigned long)zp.misses, (unsigned long)zp.drains,
+            (unsigned long)zp.zeroed_idle, (unsigned long)zp.zeroed_sync);
+}
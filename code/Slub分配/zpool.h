@@ -0,0 +1,22 @@
+#pragma once
+#include <defs.h>
+
+/*
+ * 预清零页池：空闲时（kern_init 末尾的空转循环）预先分配并清零若干 2^k 页的块，
+ * alloc_pages_zeroed 直接拿干净的块，调用路径上不再整页 memset。
+ * 池空或块太大时退回 alloc_pages + 当场清零；内存不够时先把池还给 pmm 再试。
+ */
+struct Page;
+
+void  zpool_init(void);
+/* 补充至多 budget 个块，返回实际补充的块数；池满时返回 0 */
+size_t zpool_refill(size_t budget);
+/* 把池里的块全部还给 pmm */
+void  zpool_drain(void);
+void  zpool_dump_stats(void);
+
+/* n 页全部为 0 */
+struct Page *alloc_pages_zeroed(size_t n);
+
+/* 按 8 字节宽、每轮一条 64B cache line 清零，首尾不齐的部分逐字节补 */
+void  zero_fill(void *dst, size_t n);
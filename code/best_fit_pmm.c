@@ -1,7 +1,9 @@
 #include <pmm.h>
 #include <list.h>
 #include <string.h>
+#include <spinlock.h>
 #include <best_fit_pmm.h>
+#include <pmm_bulk.h>
 #include <stdio.h>
 #include <assert.h>
 // 假设这些宏和结构体在其他头文件中定义 (如 pmm.h, memlayout.h)
@@ -18,176 +20,464 @@ static free_area_t free_area;
 #define free_list (free_area.free_list)
 #define nr_free (free_area.nr_free)
 
+/*
+ * 按大小的索引：
+ * - 1 页的空闲块放在 single_list（精确大小为 1 的 bin）；
+ * - >= 2 页的空闲块挂在 free_list 上（用块首页的 page_link，不再按地址排序），
+ *   同时挂在一棵以 (property, 地址) 为键的 treap 上。
+ *   树节点借用块内第二页的 page_link：prev 作左孩子、next 作右孩子，
+ *   优先级由页地址散列得到，因此不需要额外存储。
+ * best-fit 查找为 O(log n)，不再遍历整个 free_list。
+ *
+ * 边界标记（boundary tag）：空闲块首页带 PG_property，尾页带 PG_tail，
+ * 两者的 property 都记录块大小（1 页的块首尾是同一页，只有 PG_property）。
+ * 释放时看 base-1 与 base+n 两页即可找到物理相邻的空闲块，O(1) 完成合并。
+ */
+#define PG_tail 2
+
+#define SetPageTail(page) set_bit(PG_tail, &((page)->flags))
+#define ClearPageTail(page) clear_bit(PG_tail, &((page)->flags))
+#define PageTail(page) test_bit(PG_tail, &((page)->flags))
+
+static list_entry_t single_list;
+static struct Page *size_root;
+
+// 多 hart 时整个分配器共用一把锁，保护 free_area、single_list 与 treap
+static spinlock_t fit_lock;
+
+/*
+ * 延迟初始化：init_memmap 只清好每段开头 DEFER_CHUNK 页挂入索引，
+ * 其余页保持 PG_reserved，记在 deferred[] 里（也受 fit_lock 保护）。
+ * nr_free_pages 把它们算作空闲；索引里找不到块时再初始化一个 chunk，经 free_range 并入
+ * （与紧挨着的已初始化空闲块合并），也可由空闲 hart 通过 init_deferred 提前做完。
+ * DEFER_CHUNK 为 0 时照旧一次做完。
+ */
+#ifndef DEFER_CHUNK
+#define DEFER_CHUNK 16384
+#endif
+#define MAX_DEFERRED 8
+
+static struct {
+    struct Page *next, *end;        // [next, end) 还没初始化
+} deferred[MAX_DEFERRED];
+static int nr_deferred_ranges;
+static size_t nr_deferred;
+
+static inline list_entry_t *tree_node(struct Page *p) {
+    return &((p + 1)->page_link);
+}
+
+static inline struct Page *node2page(list_entry_t *le) {
+    return le ? le2page(le, page_link) - 1 : NULL;
+}
+
+static inline struct Page *tree_left(struct Page *p) {
+    return node2page(tree_node(p)->prev);
+}
+
+static inline struct Page *tree_right(struct Page *p) {
+    return node2page(tree_node(p)->next);
+}
+
+static inline void tree_set_left(struct Page *p, struct Page *c) {
+    tree_node(p)->prev = c ? tree_node(c) : NULL;
+}
+
+static inline void tree_set_right(struct Page *p, struct Page *c) {
+    tree_node(p)->next = c ? tree_node(c) : NULL;
+}
+
+// 由页地址散列出 treap 优先级
+static inline uint64_t tree_prio(struct Page *p) {
+    uint64_t x = (uint64_t)(uintptr_t)p;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// 键序：先比块大小，大小相同再比地址（保持与原实现相同的低地址优先）
+static inline bool tree_less(struct Page *a, struct Page *b) {
+    return a->property < b->property || (a->property == b->property && a < b);
+}
+
+static struct Page *
+tree_insert(struct Page *root, struct Page *p) {
+    if (root == NULL) {
+        tree_set_left(p, NULL);
+        tree_set_right(p, NULL);
+        return p;
+    }
+    if (tree_less(p, root)) {
+        struct Page *l = tree_insert(tree_left(root), p);
+        tree_set_left(root, l);
+        if (tree_prio(l) > tree_prio(root)) {      // 右旋
+            tree_set_left(root, tree_right(l));
+            tree_set_right(l, root);
+            root = l;
+        }
+    } else {
+        struct Page *r = tree_insert(tree_right(root), p);
+        tree_set_right(root, r);
+        if (tree_prio(r) > tree_prio(root)) {      // 左旋
+            tree_set_right(root, tree_left(r));
+            tree_set_left(r, root);
+            root = r;
+        }
+    }
+    return root;
+}
+
+// 合并两棵子树，要求 a 中所有键都小于 b 中的键
+static struct Page *
+tree_join(struct Page *a, struct Page *b) {
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+    if (tree_prio(a) > tree_prio(b)) {
+        tree_set_right(a, tree_join(tree_right(a), b));
+        return a;
+    }
+    tree_set_left(b, tree_join(a, tree_left(b)));
+    return b;
+}
+
+// 删除节点 p；调用前 p 的键（property）不能被修改
+static struct Page *
+tree_remove(struct Page *root, struct Page *p) {
+    assert(root != NULL);
+    if (root == p) {
+        return tree_join(tree_left(p), tree_right(p));
+    }
+    if (tree_less(p, root)) {
+        tree_set_left(root, tree_remove(tree_left(root), p));
+    } else {
+        tree_set_right(root, tree_remove(tree_right(root), p));
+    }
+    return root;
+}
+
+// 找 property >= n 的最小块（同大小取低地址）
+static struct Page *
+tree_lower_bound(size_t n) {
+    struct Page *best = NULL, *cur = size_root;
+    while (cur != NULL) {
+        if (cur->property >= n) {
+            best = cur;
+            cur = tree_left(cur);
+        } else {
+            cur = tree_right(cur);
+        }
+    }
+    return best;
+}
+
+// 写入首尾边界标记
+static inline void
+set_free_block(struct Page *p, size_t n) {
+    p->property = n;
+    SetPageProperty(p);
+    if (n > 1) {
+        (p + n - 1)->property = n;
+        SetPageTail(p + n - 1);
+    }
+}
+
+// 清除首尾边界标记，p->property 保持不变
+static inline void
+clear_free_block(struct Page *p) {
+    if (p->property > 1) {
+        ClearPageTail(p + p->property - 1);
+    }
+    ClearPageProperty(p);
+}
+
+// 把空闲块 p 挂入索引
+static void
+block_link(struct Page *p) {
+    if (p->property == 1) {
+        list_add(&single_list, &(p->page_link));
+        return;
+    }
+    list_add(&free_list, &(p->page_link));
+    size_root = tree_insert(size_root, p);
+}
+
+// 把空闲块 p 从索引中摘下；调用前 p 的 property 不能被修改
+static void
+block_unlink(struct Page *p) {
+    list_del(&(p->page_link));
+    if (p->property != 1) {
+        size_root = tree_remove(size_root, p);
+    }
+}
+
 static void
 best_fit_init(void) {
     list_init(&free_list);
+    list_init(&single_list);
+    size_root = NULL;
     nr_free = 0;
+    nr_deferred_ranges = 0;
+    nr_deferred = 0;
+    spin_lock_init(&fit_lock);
 }
 
 static void
-best_fit_init_memmap(struct Page *base, size_t n) {
-    assert(n > 0);
-    struct Page *p = base;
-    list_entry_t* le;
-    
-    for (; p != base + n; p ++) {
+init_pages(struct Page *base, size_t n) {
+    for (struct Page *p = base; p != base + n; p ++) {
         assert(PageReserved(p));
-        /*LAB2 EXERCISE 2: YOUR CODE*/ 
-        // 清空当前页框的标志和属性信息，并将页框的引用计数设置为0
         p->flags = 0;
         set_page_ref(p, 0);
     }
+}
+
+static void
+best_fit_init_memmap(struct Page *base, size_t n) {
+    assert(n > 0);
+
+    // 太长的段只先初始化开头一个 chunk，其余留到用时
+    if (DEFER_CHUNK > 0 && n > DEFER_CHUNK && nr_deferred_ranges < MAX_DEFERRED) {
+        deferred[nr_deferred_ranges].next = base + DEFER_CHUNK;
+        deferred[nr_deferred_ranges].end  = base + n;
+        nr_deferred_ranges ++;
+        nr_deferred += n - DEFER_CHUNK;
+        n = DEFER_CHUNK;
+    }
+
+    /*LAB2 EXERCISE 2: YOUR CODE*/ 
+    // 清空当前页框的标志和属性信息，并将页框的引用计数设置为0
+    init_pages(base, n);
     
-    // 设置第一个页框的属性
-    base->property = n;
-    SetPageProperty(base);
+    // 设置第一个页框的属性与尾页标记
+    set_free_block(base, n);
     nr_free += n;
     
-    // 插入到空闲链表，保持地址有序
-    if (list_empty(&free_list)) {
-        list_add(&free_list, &(base->page_link));
-    } else {
-        le = &free_list;
-        while ((le = list_next(le)) != &free_list) {
-            struct Page* page = le2page(le, page_link);
-            /*LAB2 EXERCISE 2: YOUR CODE*/ 
-            // 1、当base < page时，找到第一个大于base的页，将base插入到它前面，并退出循环
-            // 2、当list_next(le) == &free_list时，若已经到达链表结尾，将base插入到链表尾部
-            if (base < page) {
-                list_add_before(le, &(base->page_link));
-                break;
-            } else if (list_next(le) == &free_list) {
-                list_add(le, &(base->page_link));
-                break;
-            }
-        }
+    // 插入到空闲链表与大小索引
+    block_link(base);
+}
+
+static void free_range(struct Page *base, size_t size);
+
+// 初始化下一个延迟的 chunk 并入索引，返回页数；调用者持有 fit_lock
+static size_t
+defer_grow(void) {
+    if (nr_deferred_ranges == 0) {
+        return 0;
+    }
+    int i = nr_deferred_ranges - 1;
+    struct Page *base = deferred[i].next;
+    size_t cnt = deferred[i].end - base;
+    if (cnt > DEFER_CHUNK) {
+        cnt = DEFER_CHUNK;
+    }
+    deferred[i].next += cnt;
+    if (deferred[i].next == deferred[i].end) {
+        nr_deferred_ranges --;
+    }
+    init_pages(base, cnt);
+    nr_deferred -= cnt;
+    nr_free += cnt;
+    free_range(base, cnt);
+    return cnt;
+}
+
+// 索引里 >= n 的最佳块，没有时返回 NULL
+static struct Page *
+fit_lookup(size_t n) {
+    if (n == 1 && !list_empty(&single_list)) {
+        return le2page(list_next(&single_list), page_link);
     }
+    return tree_lower_bound(n);
 }
 
 static struct Page *
 best_fit_alloc_pages(size_t n) {
     assert(n > 0);
-    if (n > nr_free) {
+    spin_lock(&fit_lock);
+    if (n > nr_free + nr_deferred) {
+        spin_unlock(&fit_lock);
         return NULL;
     }
 
-    // 引入两个新变量：用于记录找到的最佳匹配块及其大小
-    struct Page *best_fit_page = NULL;
-    // 使用 (size_t)-1 来表示最大值
-    size_t min_property = (size_t)-1; 
+    // 1. 通过大小索引找 Best-Fit 块 (>= n 且最小)，找不到就再初始化一段延迟的页
+    struct Page *page;
+    while ((page = fit_lookup(n)) == NULL && defer_grow() > 0)
+        ;
+    if (page == NULL) {
+        spin_unlock(&fit_lock);
+        return NULL; // 未找到合适的块
+    }
 
-    list_entry_t *le = &free_list;
-    // 1. 遍历整个空闲列表，寻找 Best-Fit 块 (>= n 且最小)
-    while ((le = list_next(le)) != &free_list) {
-        struct Page *p = le2page(le, page_link);
-        
-        // 检查当前空闲块 p 是否最合适
-        if (p->property >= n && p->property < min_property) {
-            min_property = p->property;
-            best_fit_page = p;
-        }
+    // 2. 将 Best-Fit 块从索引中移除，并清除首尾标记，表示已分配
+    size_t size = page->property;
+    block_unlink(page);
+    clear_free_block(page);
+
+    // 3. 分裂：如果 Best-Fit 块有剩余空间，将分裂出的碎片挂回索引
+    if (size > n) {
+        struct Page *p_new_free = page + n;
+        set_free_block(p_new_free, size - n);
+        block_link(p_new_free);
     }
 
-    // 2. 如果找到了 Best-Fit 块
-    if (best_fit_page != NULL) {
-        struct Page *page = best_fit_page;
-        
-        // 3. 将 Best-Fit 块从链表中移除
-        list_entry_t* prev = list_prev(&(page->page_link));
-        list_del(&(page->page_link));
-
-        // 4. 分裂：如果 Best-Fit 块有剩余空间，将分裂出的碎片插回原位
-        if (page->property > n) {
-            struct Page *p_new_free = page + n;
-            p_new_free->property = page->property - n;
-            SetPageProperty(p_new_free);
-            
-            // 将碎片插入到原块的前一个元素 prev 之后
-            list_add(prev, &(p_new_free->page_link));
+    // 4. 更新统计数据
+    nr_free -= n;
+    spin_unlock(&fit_lock);
+
+    return page;
+}
+
+// 把 [base, base + size) 与物理相邻的空闲块合并后挂回索引
+// 调用前这些页的标志已清零，nr_free 也已计入；还没初始化的页带 PG_reserved，两个方向的探测都先排除它们
+static void
+free_range(struct Page *base, size_t size) {
+    struct Page *p;
+
+    // 1. 检查与高地址空闲块的合并 (向前合并)
+    // 只有空闲块首页带 PG_property，所以紧邻的下一页带标记即说明相邻
+    p = base + size;
+    if (p < pages + (npage - nbase) && !PageReserved(p) && PageProperty(p)) {
+        block_unlink(p);
+        clear_free_block(p);
+        size += p->property;
+    }
+
+    // 2. 检查与低地址空闲块的合并 (向后合并)
+    // 前一页要么是 1 页空闲块本身，要么是更大空闲块的尾页
+    if (base > pages) {
+        p = base - 1;
+        if (!PageReserved(p) && PageTail(p)) {
+            p = base - p->property;
+        }
+        /*LAB2 EXERCISE 2: YOUR CODE (B)*/ 
+        if (!PageReserved(p) && PageProperty(p)) {
+            block_unlink(p);
+            clear_free_block(p);
+            size += p->property;
+            base = p;
         }
-        
-        // 5. 更新统计数据和页属性
-        nr_free -= n;
-        ClearPageProperty(page); // 清除属性标记，表示已分配
-        
-        return page;
     }
-    
-    return NULL; // 未找到合适的块
+
+    // 3. 写入合并后块的首尾标记并挂回索引
+    set_free_block(base, size);
+    block_link(base);
 }
 
 static void
 best_fit_free_pages(struct Page *base, size_t n) {
     assert(n > 0);
     
-    // 修复编译错误: 将所有局部变量声明移到函数开始处
-    list_entry_t *le;
-    list_entry_t *le_prev;
-    list_entry_t *le_next;
     struct Page *p = base;
 
+    // 清标志也要在锁内：别的 hart 合并时会读相邻页的 flags
+    spin_lock(&fit_lock);
     for (; p != base + n; p ++) {
-        // 检查页是否未被保留且未被标记为 Property Page
-        assert(!PageReserved(p) && !PageProperty(p));
+        // 检查页是否未被保留且不带首尾标记
+        assert(!PageReserved(p) && !PageProperty(p) && !PageTail(p));
         p->flags = 0;
         set_page_ref(p, 0);
     }
     
     /*LAB2 EXERCISE 2: YOUR CODE (A)*/ 
-    // 设置当前页块的属性、标记并更新 nr_free
-    base->property = n;
-    SetPageProperty(base);
+    // 更新 nr_free，块的属性在合并完成后统一写入
     nr_free += n;
-    
-    // 1. 将页块插入到空闲链表的正确位置 (按地址从小到大排序)
-    if (list_empty(&free_list)) {
-        list_add(&free_list, &(base->page_link));
-    } else {
-        le = &free_list;
-        while ((le = list_next(le)) != &free_list) {
-            struct Page* page = le2page(le, page_link);
-            if (base < page) {
-                list_add_before(le, &(base->page_link));
-                goto merge_check; // 插入完成，跳转到合并检查
-            } else if (list_next(le) == &free_list) {
-                list_add(le, &(base->page_link));
-                goto merge_check; // 插入到链表尾部
+    free_range(base, n);
+    spin_unlock(&fit_lock);
+}
+
+// 一次分配 count 个 n 页的块，尽量从同一个空闲块里连续切出来
+static size_t
+best_fit_alloc_pages_bulk(size_t n, size_t count, struct Page **out) {
+    assert(n > 0);
+    size_t got = 0;
+
+    spin_lock(&fit_lock);
+    while (got < count && n <= nr_free + nr_deferred) {
+        size_t want = count - got;
+        struct Page *page = NULL;
+        if (n == 1 && !list_empty(&single_list)) {
+            page = le2page(list_next(&single_list), page_link);
+        } else {
+            // 先找能一次装下剩余全部块的最小空闲块，找不到再退而求其次
+            if (want > 1) {
+                page = tree_lower_bound(n * want);
+            }
+            if (page == NULL) {
+                page = tree_lower_bound(n);
             }
         }
-    }
+        if (page == NULL && defer_grow() > 0) {
+            continue;
+        }
+        if (page == NULL) {
+            break;
+        }
 
-merge_check: // 合并检查点
+        size_t size = page->property;
+        size_t take = size / n;
+        if (take > want) {
+            take = want;
+        }
+        block_unlink(page);
+        clear_free_block(page);
 
-    // 2. 检查与低地址空闲块的合并 (向后合并)
-    le_prev = list_prev(&(base->page_link));
-    if (le_prev != &free_list) {
-        p = le2page(le_prev, page_link);
-        /*LAB2 EXERCISE 2: YOUR CODE (B)*/ 
-        // 检查前面的空闲页块是否与当前页块连续并进行合并
-        if (p + p->property == base) { 
-            p->property += base->property;   // 2. 更新前一个空闲页块的大小
-            ClearPageProperty(base);         // 3. 清除当前页块的属性标记
-            list_del(&(base->page_link));    // 4. 从链表中删除当前页块
-            base = p;                        // 5. 将起始块指针指向合并后的块 p
+        // 整块只分裂一次，剩余部分挂回索引
+        for (size_t i = 0; i < take; i ++) {
+            out[got ++] = page + i * n;
+        }
+        if (size > take * n) {
+            struct Page *p_new_free = page + take * n;
+            set_free_block(p_new_free, size - take * n);
+            block_link(p_new_free);
         }
+        nr_free -= take * n;
     }
+    spin_unlock(&fit_lock);
+    return got;
+}
+
+// 一次释放 count 个 n 页的块：排序后地址连续的块先拼成一段，每段只合并、入索引一次
+static void
+best_fit_free_pages_bulk(struct Page **v, size_t n, size_t count) {
+    assert(n > 0);
+    pmm_sort_blocks(v, count);
 
-    // 3. 检查与高地址空闲块的合并 (向前合并)
-    // 注意：如果上一步发生了合并，base 已经是 p (低地址块)
-    le_next = list_next(&(base->page_link));
-    if (le_next != &free_list) {
-        p = le2page(le_next, page_link);
-        if (base + base->property == p) { // 检查是否连续
-            base->property += p->property;
-            ClearPageProperty(p);
-            list_del(&(p->page_link));
+    size_t i = 0;
+    spin_lock(&fit_lock);
+    while (i < count) {
+        struct Page *base = v[i], *p;
+        size_t size = n;
+        while (++ i < count && v[i] == base + size) {
+            size += n;
         }
+        for (p = base; p != base + size; p ++) {
+            assert(!PageReserved(p) && !PageProperty(p) && !PageTail(p));
+            p->flags = 0;
+            set_page_ref(p, 0);
+        }
+        nr_free += size;
+        free_range(base, size);
     }
+    spin_unlock(&fit_lock);
 }
 
 static size_t
 best_fit_nr_free_pages(void) {
-    return nr_free;
+    return nr_free + nr_deferred;
+}
+
+// 后台初始化：至少做 budget 页（按 chunk 取整）或做完为止
+static size_t
+best_fit_init_deferred(size_t budget) {
+    size_t done = 0, cnt;
+    spin_lock(&fit_lock);
+    while (done < budget && (cnt = defer_grow()) > 0) {
+        done += cnt;
+    }
+    spin_unlock(&fit_lock);
+    return done;
 }
 
 // ----------------------------------------------------------------------
@@ -209,6 +499,16 @@ basic_check(void) {
     // ... (此处省略 basic_check 的其余部分，因为它依赖于外部宏) ...
 }
 
+// 统计 treap 节点数，并顺带检查键序与堆序
+static int
+tree_count(struct Page *root) {
+    if (root == NULL) return 0;
+    struct Page *l = tree_left(root), *r = tree_right(root);
+    assert(l == NULL || (tree_less(l, root) && tree_prio(l) <= tree_prio(root)));
+    assert(r == NULL || (tree_less(root, r) && tree_prio(r) <= tree_prio(root)));
+    return 1 + tree_count(l) + tree_count(r);
+}
+
 static void
 best_fit_check(void) {
     int score = 0 ,sumscore = 6;
@@ -216,10 +516,29 @@ best_fit_check(void) {
     list_entry_t *le = &free_list;
     while ((le = list_next(le)) != &free_list) {
         struct Page *p = le2page(le, page_link);
-        assert(PageProperty(p));
+        assert(PageProperty(p) && p->property >= 2);
+        assert(PageTail(p + p->property - 1) && (p + p->property - 1)->property == p->property);
+        count ++, total += p->property;
+    }
+    assert(tree_count(size_root) == count);
+    le = &single_list;
+    while ((le = list_next(le)) != &single_list) {
+        struct Page *p = le2page(le, page_link);
+        assert(PageProperty(p) && p->property == 1);
         count ++, total += p->property;
     }
-    assert(total == nr_free_pages());
+    assert(total + nr_deferred == nr_free_pages());
+    total = nr_free_pages();
+
+    // 批量接口：连续切出的块释放后应完整合并回去
+    struct Page *batch[16];
+    size_t got = best_fit_alloc_pages_bulk(2, 16, batch);
+    assert(got == 16 && nr_free_pages() == total - 32);
+    for (int i = 1; i < 16; i ++) {
+        assert(batch[i] == batch[0] + 2 * i);
+    }
+    best_fit_free_pages_bulk(batch, 2, got);
+    assert(nr_free_pages() == total);
 
     // basic_check(); // 依赖外部宏，保留注释
 
@@ -239,6 +558,9 @@ const struct pmm_manager best_fit_pmm_manager = {
     .init_memmap = best_fit_init_memmap,
     .alloc_pages = best_fit_alloc_pages,
     .free_pages = best_fit_free_pages,
+    .alloc_pages_bulk = best_fit_alloc_pages_bulk,
+    .free_pages_bulk = best_fit_free_pages_bulk,
     .nr_free_pages = best_fit_nr_free_pages,
     .check = best_fit_check,
+    .init_deferred = best_fit_init_deferred,
 };
\ No newline at end of file
@@ -0,0 +1,311 @@
+#include <pmm.h>
+#include <string.h>
+#include <stdio.h>
+#include <memlayout.h>
+#include <spinlock.h>
+#include <bitmap_pmm.h>
+
+/*
+ * 位图页分配器：每个物理页对应一位，1 表示空闲、0 表示已分配或不归本分配器管。
+ * 查找按 64 位整字扫描：整字全 1 / 全 0 直接跳过，其余用 ctz 求连续 1 的长度，
+ * 不在 struct Page 上串链表，order-0 的反复分配/释放只读写位图。
+ */
+
+#ifndef BITMAP_MAX_PAGES
+#define BITMAP_MAX_PAGES (1UL << 18)      /* 可管理的最大页数（1GiB），位图放 BSS */
+#endif
+
+#define WORD_BITS  64
+#define NR_WORDS   ((BITMAP_MAX_PAGES + WORD_BITS - 1) / WORD_BITS)
+#define ALL_ONES   (~(uint64_t)0)
+
+static uint64_t free_map[NR_WORDS];
+static size_t   nr_words;           /* 已用到的字数（最高管理页所在字 + 1） */
+static size_t   hint_word;          /* 该字之前不存在空闲位 */
+static size_t   nr_free;
+static spinlock_t map_lock;         /* 保护位图与上面三个变量 */
+
+extern struct Page *pages;
+
+/* ========= 位运算小工具 ========= */
+/* de Bruijn 法求 ctz，避免依赖 libgcc 的 __ctzdi2 */
+static const uint8_t debruijn_ctz[64] = {
+     0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+    62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+    63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+    46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6,
+};
+
+/* x 必须非 0 */
+static inline int ctz64(uint64_t x) {
+    return debruijn_ctz[((x & -x) * 0x03f79d71b4cb0a89ULL) >> 58];
+}
+
+/* 第 [lo, lo+len) 位为 1 的掩码，要求 lo + len <= 64 */
+static inline uint64_t bit_mask(int lo, int len) {
+    return (len == WORD_BITS ? ALL_ONES : (((uint64_t)1 << len) - 1)) << lo;
+}
+
+/* 把 [idx, idx+n) 置 1（set != 0）或清 0，顺带断言原状态正好相反 */
+static void map_update(size_t idx, size_t n, int set) {
+    while (n > 0) {
+        size_t w  = idx / WORD_BITS;
+        int    lo = (int)(idx % WORD_BITS);
+        int    len = (n < (size_t)(WORD_BITS - lo)) ? (int)n : (WORD_BITS - lo);
+        uint64_t m = bit_mask(lo, len);
+        if (set) {
+            assert((free_map[w] & m) == 0);
+            free_map[w] |= m;
+        } else {
+            assert((free_map[w] & m) == m);
+            free_map[w] &= ~m;
+        }
+        idx += len;
+        n   -= len;
+    }
+}
+
+/* 从 hint_word 起找第一段长度 >= n 的连续 1，返回起始位号；找不到返回 (size_t)-1 */
+static size_t map_find_run(size_t n) {
+    size_t run = 0, start = 0;
+    for (size_t w = hint_word; w < nr_words; w++) {
+        uint64_t x = free_map[w];
+        if (x == ALL_ONES) {
+            if (run == 0) start = w * WORD_BITS;
+            run += WORD_BITS;
+            if (run >= n) return start;
+            continue;
+        }
+        if (x == 0) {
+            run = 0;
+            continue;
+        }
+        int bit = 0;
+        while (bit < WORD_BITS) {
+            uint64_t y = x >> bit;
+            if (y & 1) {
+                /* y 高位已被移入 0，所以 ~y 非 0，ctz 即为连续 1 的个数 */
+                int ones = ctz64(~y);
+                if (run == 0) start = w * WORD_BITS + bit;
+                run += ones;
+                if (run >= n) return start;
+                bit += ones;
+            } else {
+                run = 0;
+                if (y == 0) break;
+                bit += ctz64(y);
+            }
+        }
+    }
+    return (size_t)-1;
+}
+
+/* ========= pmm_manager 接口 ========= */
+static void bitmap_init(void) {
+    memset(free_map, 0, sizeof(free_map));
+    nr_words  = 0;
+    hint_word = 0;
+    nr_free   = 0;
+    spin_lock_init(&map_lock);
+}
+
+static void bitmap_init_memmap(struct Page *base, size_t n) {
+    assert(n > 0);
+    size_t idx = (size_t)(base - pages);
+    assert(idx + n <= BITMAP_MAX_PAGES);
+
+    for (struct Page *p = base; p != base + n; p++) {
+        assert(PageReserved(p));
+        p->flags = 0;
+        p->property = 0;
+        set_page_ref(p, 0);
+    }
+    map_update(idx, n, 1);
+
+    size_t end_word = (idx + n + WORD_BITS - 1) / WORD_BITS;
+    if (end_word > nr_words) nr_words = end_word;
+    if (nr_free == 0 || idx / WORD_BITS < hint_word) hint_word = idx / WORD_BITS;
+    nr_free += n;
+}
+
+/* 以下 map_* 不加锁，由调用者持有 map_lock */
+static struct Page *map_alloc(size_t n) {
+    if (n > nr_free) return NULL;
+
+    size_t idx;
+    if (n == 1) {
+        /* 单页：找第一个非 0 字，ctz 即得 */
+        size_t w = hint_word;
+        while (w < nr_words && free_map[w] == 0) w++;
+        hint_word = w;
+        if (w == nr_words) return NULL;
+        idx = w * WORD_BITS + ctz64(free_map[w]);
+    } else {
+        idx = map_find_run(n);
+        if (idx == (size_t)-1) return NULL;
+    }
+
+    map_update(idx, n, 0);
+    nr_free -= n;
+    return pages + idx;
+}
+
+static struct Page *bitmap_alloc_pages(size_t n) {
+    assert(n > 0);
+    spin_lock(&map_lock);
+    struct Page *p = map_alloc(n);
+    spin_unlock(&map_lock);
+    return p;
+}
+
+static void bitmap_free_pages(struct Page *base, size_t n) {
+    assert(n > 0);
+    for (struct Page *p = base; p != base + n; p++) {
+        assert(!PageReserved(p));
+        p->flags = 0;
+        set_page_ref(p, 0);
+    }
+
+    size_t idx = (size_t)(base - pages);
+    spin_lock(&map_lock);
+    map_update(idx, n, 1);
+    if (idx / WORD_BITS < hint_word) hint_word = idx / WORD_BITS;
+    nr_free += n;
+    spin_unlock(&map_lock);
+}
+
+/*
+ * 批量分配：先找一段能装下全部 count 块的连续空闲位，一次清位；
+ * 找不到时单页请求逐字取位（每个字只读写一次），多页请求退回逐块分配。
+ */
+static size_t map_alloc_bulk(size_t n, size_t count, struct Page **out) {
+    if (count == 0) return 0;
+
+    if (n * count <= nr_free) {
+        size_t idx = map_find_run(n * count);
+        if (idx != (size_t)-1) {
+            map_update(idx, n * count, 0);
+            nr_free -= n * count;
+            for (size_t i = 0; i < count; i++) out[i] = pages + idx + i * n;
+            return count;
+        }
+    }
+
+    size_t got = 0;
+    if (n == 1) {
+        for (size_t w = hint_word; w < nr_words && got < count; w++) {
+            uint64_t x = free_map[w];
+            while (x != 0 && got < count) {
+                int bit = ctz64(x);
+                x &= x - 1;
+                out[got++] = pages + w * WORD_BITS + bit;
+            }
+            free_map[w] = x;
+            if (x == 0) hint_word = w + 1;
+        }
+        nr_free -= got;
+        return got;
+    }
+
+    while (got < count) {
+        struct Page *p = map_alloc(n);
+        if (p == NULL) break;
+        out[got++] = p;
+    }
+    return got;
+}
+
+static size_t bitmap_alloc_pages_bulk(size_t n, size_t count, struct Page **out) {
+    assert(n > 0);
+    spin_lock(&map_lock);
+    size_t got = map_alloc_bulk(n, count, out);
+    spin_unlock(&map_lock);
+    return got;
+}
+
+/* 批量释放：位图本身与顺序无关，逐块置位，最后统一更新 hint 与计数 */
+static void bitmap_free_pages_bulk(struct Page **v, size_t n, size_t count) {
+    assert(n > 0);
+    spin_lock(&map_lock);
+    size_t low = hint_word;
+    for (size_t i = 0; i < count; i++) {
+        for (struct Page *p = v[i]; p != v[i] + n; p++) {
+            assert(!PageReserved(p));
+            p->flags = 0;
+            set_page_ref(p, 0);
+        }
+        size_t idx = (size_t)(v[i] - pages);
+        map_update(idx, n, 1);
+        if (idx / WORD_BITS < low) low = idx / WORD_BITS;
+    }
+    hint_word = low;
+    nr_free += n * count;
+    spin_unlock(&map_lock);
+}
+
+static size_t bitmap_nr_free_pages(void) {
+    return nr_free;
+}
+
+/* ========= 自检 ========= */
+static size_t count_free_bits(void) {
+    size_t cnt = 0;
+    for (size_t w = 0; w < nr_words; w++) {
+        uint64_t x = free_map[w];
+        while (x) { x &= x - 1; cnt++; }
+    }
+    return cnt;
+}
+
+static void bitmap_check(void) {
+    cprintf("[bitmap] 基本检查开始...\n");
+    size_t total = bitmap_nr_free_pages();
+    assert(count_free_bits() == total);
+
+    struct Page *a = bitmap_alloc_pages(1);
+    struct Page *b = bitmap_alloc_pages(1);
+    struct Page *c = bitmap_alloc_pages(1);
+    assert(a && b && c && a != b && b != c && a != c);
+    assert(bitmap_nr_free_pages() == total - 3);
+
+    /* 释放后再分配应复用最低地址的空闲页 */
+    bitmap_free_pages(b, 1);
+    assert(bitmap_alloc_pages(1) == b);
+
+    /* 跨字的连续区间 */
+    struct Page *r1 = bitmap_alloc_pages(100);
+    struct Page *r2 = bitmap_alloc_pages(3);
+    assert(r1 && r2 && (r2 >= r1 + 100 || r2 + 3 <= r1));
+    bitmap_free_pages(r1, 100);
+    struct Page *r3 = bitmap_alloc_pages(64);
+    assert(r3 != NULL && r3 <= r1);
+
+    /* 批量接口 */
+    struct Page *batch[70];
+    assert(bitmap_alloc_pages_bulk(1, 70, batch) == 70);
+    for (int i = 1; i < 70; i++) assert(batch[i] == batch[0] + i);
+    bitmap_free_pages_bulk(batch, 1, 70);
+
+    bitmap_free_pages(r3, 64);
+    bitmap_free_pages(r2, 3);
+    bitmap_free_pages(a, 1);
+    bitmap_free_pages(b, 1);
+    bitmap_free_pages(c, 1);
+    assert(bitmap_nr_free_pages() == total);
+    assert(count_free_bits() == total);
+
+    cprintf("[bitmap] 检查通过，nr_free=%lu, 位图字数=%lu\n",
+            (unsigned long)total, (unsigned long)nr_words);
+}
+
+const struct pmm_manager bitmap_pmm_manager = {
+    .name           = "bitmap_pmm_manager",
+    .init           = bitmap_init,
+    .init_memmap    = bitmap_init_memmap,
+    .alloc_pages    = bitmap_alloc_pages,
+    .free_pages     = bitmap_free_pages,
+    .alloc_pages_bulk = bitmap_alloc_pages_bulk,
+    .free_pages_bulk  = bitmap_free_pages_bulk,
+    .nr_free_pages  = bitmap_nr_free_pages,
+    .check          = bitmap_check,
+};
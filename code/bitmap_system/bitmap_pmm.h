@@ -0,0 +1,5 @@
+#ifndef __KERN_MM_BITMAP_PMM_H__
+#define __KERN_MM_BITMAP_PMM_H__
+#include <pmm.h>
+extern const struct pmm_manager bitmap_pmm_manager;
+#endif
@@ -3,30 +3,204 @@
 #include <string.h>
 #include <stdio.h>
 #include <memlayout.h>
+#include <smp.h>
+#include <spinlock.h>
 #include <buddy_pmm.h>
+#include <pmm_bulk.h>
+
+
+/*
+ * MAX_ORDER 可在编译时改：默认 14（64MiB）；要分 Sv39 吉页（1GiB，第 18 阶）时
+ * 定义 MAX_ORDER=18，并让 BUDDY_MAX_PAGES 与物理内存都够大。order_mask 是 32 位，阶不能超过 31。
+ */
+#define MIN_ORDER 0
+#ifndef MAX_ORDER
+#define MAX_ORDER 14
+#endif
+#if MAX_ORDER > 31
+#error "MAX_ORDER must fit in the 32-bit order masks"
+#endif
+#define ORDER_PAGES(k) ((size_t)1UL << (k))
 
+/*
+ * 每阶一张伙伴配对位图：第 k 阶每对伙伴 (idx, idx ^ 2^k) 占一位，
+ * 该阶链表每插入或摘下一块就翻转一次，于是位为 1 当且仅当这对伙伴恰有一块空闲。
+ * 释放时自己尚未入表，配对位为 1 即说明伙伴空闲，不必去读伙伴的 struct Page。
+ * order_mask 第 k 位表示第 k 阶链表非空，分配时一次 ctz 就能找到可用的最低阶。
+ * 链表不再按地址排序，插入与摘除都是 O(1)。
+ */
+#ifndef BUDDY_MAX_PAGES
+#define BUDDY_MAX_PAGES (1UL << 18)     /* 可管理的最大页数（1GiB），位图放 BSS */
+#endif
 
-#define MIN_ORDER 0                 
-#define MAX_ORDER 14                
-#define ORDER_PAGES(k) ((size_t)1UL << (k))
+#if BUDDY_MAX_PAGES < (1UL << MAX_ORDER)
+#error "BUDDY_MAX_PAGES must hold at least one MAX_ORDER block"
+#endif
+
+#define PAIR_WORDS (BUDDY_MAX_PAGES / 64 + MAX_ORDER + 1)
 
 typedef struct {
-    list_entry_t free_list;         
-    size_t       nr_free;           
+    list_entry_t free_list[MT_TYPES];   /* 每种分配类型一条 */
+    size_t       nr_free;               /* 该阶各类型块数之和 */
 } buddy_area_t;
 
-static buddy_area_t areas[MAX_ORDER + 1];
-static size_t total_free_pages;    
+/*
+ * 按分配类型分组（仿 Linux 的 migratetype / pageblock）：
+ * 内存按 2^PAGEBLOCK_ORDER 页划成 pageblock，每个 pageblock 标一个类型（初始全是 MT_MOVABLE）。
+ * 空闲块按所在 pageblock 的类型挂到对应链表，类型记在块首页 flags 的 PG_mt 位段里，
+ * 摘链时照此找表，不依赖 pageblock 标签当时的值。
+ * 分配先找本类型的链表；没有时按 mt_fallback 顺序从别的类型里取最大的块：
+ * 块本身不小于 pageblock 就把要用到的 pageblock 改标过来；
+ * 否则所在 pageblock 空闲过半才整块改标（连同里面已空闲的块一起搬到本类型链表），
+ * 不过半就只借这一次。这样长期驻留的 slab 页集中在少数 pageblock 里，
+ * 不会把每个大块都钉住。MT_GROUPING 为 0 时所有请求都按 MT_MOVABLE 处理，等同不分组。
+ */
+#ifndef MT_GROUPING
+#define MT_GROUPING 1
+#endif
+#if MAX_ORDER < 9
+#define PAGEBLOCK_ORDER MAX_ORDER
+#else
+#define PAGEBLOCK_ORDER 9
+#endif
+#define PAGEBLOCK_PAGES ORDER_PAGES(PAGEBLOCK_ORDER)
+
+#define PG_mt 3                         /* 空闲块所在链表的类型，占 flags 的 bit 3..4 */
+
+/*
+ * 物理内存分区（zone）管理：每次 init_memmap（每个 DTB 内存节点一次）建一个区；
+ * 编译时定义 ZONE_DMA_LIMIT（物理地址）时，低于它的页再单独划成 DMA 区。
+ * 每区有自己的各阶链表、order_mask、空闲计数与锁，伙伴合并不跨出区边界。
+ * 分配按回退顺序逐区尝试：高地址的普通区在前，DMA 区垫底，尽量把低端内存留给设备；
+ * 某区不够时靠 nr_free 与 order_mask 当场判断，不会去扫别区的链表。
+ * 配对位图按全局页号编址，各区共用一张：区内的伙伴对只被本区翻转，
+ * 跨区的伙伴对在合并前就被边界判断挡掉，从不读取。
+ */
+#ifndef MAX_ZONES
+#define MAX_ZONES 4
+#endif
+
+/*
+ * 延迟合并（lazy buddy）：LAZY_HIGH > 0 时，释放的块若所在阶的空闲块数还不到 LAZY_HIGH，
+ * 就原样留在该阶（“局部空闲”），伙伴空闲也不合并；该阶块数到了 LAZY_HIGH 才照常逐阶合并。
+ * 小块反复分配/释放时，同一个高阶块不再被一遍遍拆开又拼回。
+ * 跳过了合并的块带 PG_lazy 标记：它被原样分配出去时，记一次省掉的分裂；
+ * 它后来还是被合并了，记一次补做的合并。高阶分配找不到块而区内还有带标记的块时，
+ * 先把整区能合并的伙伴一次合并完（zone_coalesce）再重试。
+ * 配对位在延迟模式下含义不变（位为 1 当且仅当恰有一块在表里），合并判断照旧 O(1)。
+ * LAZY_HIGH 为 0（默认）时关闭，与原来的立即合并完全一样。
+ */
+#ifndef LAZY_HIGH
+#define LAZY_HIGH 0
+#endif
+
+/*
+ * 大页预留池（仿 CMA）：HUGE_POOL_PAGES > 0 时，第一段放得下的 init_memmap 把顶端对齐的
+ * HUGE_POOL_PAGES 页（连同对齐后剩下的零头）单独建成 "Huge" 区。区边界挡住合并，
+ * 池里的块不会和外面拼在一起再被拆走。
+ * 对齐粒度不小于 2^HUGE_ORDER（Sv39 兆页，2MiB）的 alloc_pages_aligned 先找池，再找别的区；
+ * 其余请求先找普通区，都不够时只有可移动/可回收的请求才向池借，不可移动的永远不进池。
+ * 借走的页释放后回到池里；大页请求在池中找不到块时，先清空各 hart 的单页缓存
+ * （里面可能压着借来的页）再试一次。HUGE_POOL_PAGES 为 0（默认）时不建池。
+ */
+/*
+ * 延迟初始化 struct Page：建区时只把开头到第一个 DEFER_CHUNK 边界（按全局页号）的页清好入表，
+ * 其余页保持 pmm_init 留下的 PG_reserved，记在区的 [init_end, end) 里。
+ * nr_free_pages 把这些页算作空闲；区里分配不到时先按 chunk 初始化一段（经 area_free 入表，
+ * 与已初始化的部分照常合并）再重试，空闲 hart 也可以通过 init_deferred 提前做完。
+ * chunk 默认取最高阶块大小，新初始化的一段正好是若干个对齐的最高阶块。DEFER_CHUNK 为 0 时建区即全部初始化。
+ */
+#ifndef DEFER_CHUNK
+#define DEFER_CHUNK ORDER_PAGES(MAX_ORDER)
+#endif
+#define DEFER_UNIT (DEFER_CHUNK > 0 ? DEFER_CHUNK : 1)   /* 只为免去除零告警 */
+
+#define HUGE_ORDER 9
+#define HUGE_PAGES ORDER_PAGES(HUGE_ORDER)
+#ifndef HUGE_POOL_PAGES
+#define HUGE_POOL_PAGES 0
+#endif
+#if HUGE_POOL_PAGES % (1UL << HUGE_ORDER) != 0 || (HUGE_POOL_PAGES > 0 && MAX_ORDER < HUGE_ORDER)
+#error "HUGE_POOL_PAGES must be a multiple of the megapage size and fit MAX_ORDER"
+#endif
+
+#define PG_lazy 2
+
+#define SetPageLazy(page) set_bit(PG_lazy, &((page)->flags))
+#define ClearPageLazy(page) clear_bit(PG_lazy, &((page)->flags))
+#define PageLazy(page) test_bit(PG_lazy, &((page)->flags))
+
+typedef struct {
+    const char  *name;
+    int          idx;                   /* 同名的区按建立顺序编号，打印成 Normal0、Normal1… */
+    size_t       start, end;            /* 管理 pages[start, end) */
+    spinlock_t   lock;                  /* 保护本区下面所有字段 */
+    buddy_area_t areas[MAX_ORDER + 1];
+    uint32_t     order_mask;
+    size_t       nr_free;
+    size_t       splits, merges;
+    size_t       allocs, fallbacks;     /* 本区满足的分配次数 / 其中首选区不够才落到本区的次数 */
+    size_t       lazy_pending;          /* 当前带 PG_lazy 的空闲块数 */
+    size_t       lazy_deferred;         /* 跳过的合并次数 */
+    size_t       lazy_reused;           /* 带标记的块直接分配出去的次数（省掉的分裂） */
+    size_t       lazy_merged;           /* 带标记的块后来又被合并的次数 */
+    size_t       coalesce_runs;         /* zone_coalesce 执行次数 */
+    uint32_t     type_mask[MT_TYPES];   /* 第 k 位：第 k 阶该类型链表非空 */
+    size_t       mt_allocs[MT_TYPES];   /* 各类型分配出去的块数 */
+    size_t       mt_fallbacks;          /* 本类型没有、从别的类型借块的次数 */
+    size_t       mt_steals;             /* 因此改标的 pageblock 数 */
+    int          is_pool;               /* 大页预留池 */
+    size_t       borrowed;              /* 池：借给普通请求的次数 */
+    size_t       init_end;              /* [init_end, end) 的 struct Page 还没初始化 */
+    size_t       deferred_grows;        /* 按需或后台初始化的 chunk 数 */
+} zone_t;
+
+static const int mt_fallback[MT_TYPES][MT_TYPES - 1] = {
+    [MT_UNMOVABLE]   = { MT_RECLAIMABLE, MT_MOVABLE },
+    [MT_RECLAIMABLE] = { MT_UNMOVABLE,   MT_MOVABLE },
+    [MT_MOVABLE]     = { MT_RECLAIMABLE, MT_UNMOVABLE },
+};
+
+static const char *const mt_name[MT_TYPES] = { "unmovable", "reclaimable", "movable" };
+
+static uint8_t pb_type[BUDDY_MAX_PAGES >> PAGEBLOCK_ORDER];
+
+static zone_t  zones[MAX_ZONES];            /* 按建立顺序存放，建好后不再移动 */
+static zone_t *zone_order[MAX_ZONES];       /* 按起始地址升序，分配时从后往前回退 */
+static int     nr_zones;
+static zone_t *huge_pool;                   /* 未建池时为 NULL */
+
+/*
+ * 每个 hart 一条单页缓存（仿 Linux per-cpu page list，NR_HARTS 见 smp.h）：
+ * 单页的分配与释放先走本 hart 的缓存，不碰各区的 areas[]。
+ * 缓存空了一次批量取 PCP_BATCH 页（一次分裂），超过 PCP_HIGH 就按地址排序后
+ * 批量还回 PCP_BATCH 页（一趟合并），每页回到自己所在的区。PCP_HIGH 为 0 时关闭缓存。
+ * 缓存里的页不在 areas[] 中，也不带 PG_property；高阶分配失败时会先清空所有缓存再重试。
+ * 需要同时持锁时先拿缓存锁、再拿区锁，区锁之间从不嵌套。
+ */
+#ifndef PCP_HIGH
+#define PCP_HIGH  64
+#endif
+#ifndef PCP_BATCH
+#define PCP_BATCH 16
+#endif
+
+typedef struct {
+    spinlock_t   lock;
+    list_entry_t list;
+    size_t       count;
+    size_t       hits, refills, drains;
+} pcp_list_t;
+
+static pcp_list_t pcp[NR_HARTS];
+
+static uint64_t pair_map[PAIR_WORDS];
+static size_t   pair_base[MAX_ORDER + 1];   /* 各阶配对位在 pair_map 中的起始位号 */
 
 extern struct Page *pages;
 extern size_t npage;
 
 
-static inline void area_init(int k) {
-    list_init(&areas[k].free_list);
-    areas[k].nr_free = 0;
-}
-
 static inline void mark_block_head(struct Page *p, size_t sz_pages) {
     p->property = sz_pages;
     SetPageProperty(p);
@@ -35,34 +209,92 @@ static inline void mark_block_head(struct Page *p, size_t sz_pages) {
 static inline void clear_block_head(struct Page *p) {
     p->property = 0;
     ClearPageProperty(p);
+    p->flags &= ~((uint64_t)3 << PG_mt);
 }
 
-static void area_push(int k, struct Page *p) {
-    list_entry_t *head = &areas[k].free_list;
-    list_entry_t *le = head;
-    while ((le = list_next(le)) != head) {
-        if (p < le2page(le, page_link)) break;
-    }
-    list_add_before(le, &(p->page_link));
-    areas[k].nr_free++;
-    total_free_pages += ORDER_PAGES(k);
+static inline int block_mt(struct Page *p) {
+    return (int)((p->flags >> PG_mt) & 3);
+}
+
+static inline void set_block_mt(struct Page *p, int mt) {
+    p->flags = (p->flags & ~((uint64_t)3 << PG_mt)) | ((uint64_t)mt << PG_mt);
+}
+
+/* 页所在 pageblock 的类型，也就是它空闲时该挂的链表 */
+static inline int pb_mt(struct Page *p) {
+#if MT_GROUPING
+    return pb_type[(size_t)(p - pages) >> PAGEBLOCK_ORDER];
+#else
+    return MT_MOVABLE;
+#endif
+}
+
+/* de Bruijn 法求 ctz，避免依赖 libgcc 的 __ctzsi2；x 必须非 0 */
+static const uint8_t debruijn_ctz32[32] = {
+     0,  1, 28,  2, 29, 14, 24,  3, 30, 22, 20, 15, 25, 17,  4,  8,
+    31, 27, 13, 23, 21, 19, 16,  7, 26, 12, 18,  6, 11,  5, 10,  9,
+};
+
+static inline int ctz32(uint32_t x) {
+    return debruijn_ctz32[((x & -x) * 0x077cb531U) >> 27];
+}
+
+static inline size_t pair_bit(int k, struct Page *p) {
+    return pair_base[k] + ((size_t)(p - pages) >> (k + 1));
+}
+
+/*
+ * 每一位只在所属区的锁下改，但区边界不按字对齐，相邻两个区的位可能落在同一个字里，
+ * 两把锁互不排斥，所以整字读改写要用原子操作，否则会丢掉另一个区刚翻的位。
+ */
+static inline void pair_toggle(int k, struct Page *p) {
+    size_t b = pair_bit(k, p);
+    __atomic_fetch_xor(&pair_map[b / 64], (uint64_t)1 << (b % 64), __ATOMIC_RELAXED);
 }
 
-static struct Page *area_pop(int k) {
-    list_entry_t *head = &areas[k].free_list;
+static inline int pair_test(int k, struct Page *p) {
+    size_t b = pair_bit(k, p);
+    return (__atomic_load_n(&pair_map[b / 64], __ATOMIC_RELAXED) >> (b % 64)) & 1;
+}
+
+static void area_push(zone_t *z, int k, struct Page *p) {
+    int mt = pb_mt(p);
+    set_block_mt(p, mt);
+    list_add(&z->areas[k].free_list[mt], &(p->page_link));
+    z->areas[k].nr_free++;
+    z->nr_free += ORDER_PAGES(k);
+    z->order_mask |= 1U << k;
+    z->type_mask[mt] |= 1U << k;
+    pair_toggle(k, p);
+}
+
+static void area_remove_block(zone_t *z, int k, struct Page *p) {
+    int mt = block_mt(p);
+    list_del(&(p->page_link));
+    z->areas[k].nr_free--;
+    z->nr_free -= ORDER_PAGES(k);
+    if (z->areas[k].nr_free == 0) z->order_mask &= ~(1U << k);
+    if (list_empty(&z->areas[k].free_list[mt])) z->type_mask[mt] &= ~(1U << k);
+    pair_toggle(k, p);
+}
+
+static struct Page *area_pop(zone_t *z, int k, int mt) {
+    list_entry_t *head = &z->areas[k].free_list[mt];
     if (list_empty(head)) return NULL;
-    list_entry_t *le = list_next(head);
-    list_del(le);
-    struct Page *p = le2page(le, page_link);
-    areas[k].nr_free--;
-    total_free_pages -= ORDER_PAGES(k);
+    struct Page *p = le2page(list_next(head), page_link);
+    area_remove_block(z, k, p);
     return p;
 }
 
-static void area_remove_block(int k, struct Page *p) {
+/* 空闲块换到 mt 类型的链表，不动计数与配对位 */
+static void area_move_type(zone_t *z, int k, struct Page *p, int mt) {
+    int old = block_mt(p);
+    if (old == mt) return;
     list_del(&(p->page_link));
-    areas[k].nr_free--;
-    total_free_pages -= ORDER_PAGES(k);
+    if (list_empty(&z->areas[k].free_list[old])) z->type_mask[old] &= ~(1U << k);
+    set_block_mt(p, mt);
+    list_add(&z->areas[k].free_list[mt], &(p->page_link));
+    z->type_mask[mt] |= 1U << k;
 }
 
 
@@ -70,9 +302,16 @@ static inline size_t buddy_index(size_t idx, size_t size) {
     return idx ^ size;
 }
 
+/* floor(log2(x))，x 必须非 0；二分，固定 6 步 */
 static int ilog2_floor(size_t x) {
+    uint64_t v = x;
     int k = 0;
-    while ((x >> (k + 1)) != 0) k++;
+    if (v >> 32) { v >>= 32; k += 32; }
+    if (v >> 16) { v >>= 16; k += 16; }
+    if (v >> 8)  { v >>= 8;  k += 8; }
+    if (v >> 4)  { v >>= 4;  k += 4; }
+    if (v >> 2)  { v >>= 2;  k += 2; }
+    if (v >> 1)  { k += 1; }
     return k;
 }
 static int ilog2_ceil(size_t x) {
@@ -81,14 +320,71 @@ static int ilog2_ceil(size_t x) {
 }
 
 
-static void buddy_init(void) {
-    for (int k = MIN_ORDER; k <= MAX_ORDER; k++) area_init(k);
-    total_free_pages = 0;
+/*
+ * 页号 idx 处、剩余 left 页时能切出的最大对齐块的阶：
+ * 既不超过 left，也不超过 idx 的对齐粒度 (idx & -idx)。
+ * idx 既可以是区间起点（向上拆），也可以是区间终点（向下拆），两种情况下块都是对齐的。
+ */
+static inline int piece_order(size_t idx, size_t left) {
+    int k = ilog2_floor(left);
+    if (idx != 0) {
+        int a = ilog2_floor(idx & -idx);
+        if (a < k) k = a;
+    }
+    return k > MAX_ORDER ? MAX_ORDER : k;
 }
 
-static void buddy_init_memmap(struct Page *base, size_t n) {
-    assert(n > 0);
+/*
+ * 把 [cur, cur+remain) 按对齐拆成若干 2^k 块挂回 z 的各阶，返回块数。
+ * 对齐块尾部 [n, 2^K) 的拆法正好是 2^K - n 的各个二进制位，最多 K 块，每块 O(1)。
+ */
+static size_t push_range(zone_t *z, struct Page *cur, size_t remain) {
+    size_t cur_idx = (size_t)(cur - pages);
+    size_t pieces = 0;
+    while (remain > 0) {
+        pieces++;
+        int k = piece_order(cur_idx, remain);
+        size_t sz = ORDER_PAGES(k);
+        mark_block_head(cur, sz);
+        area_push(z, k, cur);
+        cur     += sz;
+        cur_idx += sz;
+        remain  -= sz;
+    }
+    return pieces;
+}
 
+/* 页所在的区；区数很少，线性找即可 */
+static zone_t *page_zone(struct Page *p) {
+    size_t idx = (size_t)(p - pages);
+    for (int i = 0; i < nr_zones; i++) {
+        if (idx >= zones[i].start && idx < zones[i].end) return &zones[i];
+    }
+    cprintf("[buddy] E: page %lu is not in any zone\n", (unsigned long)idx);
+    assert(0);
+    return NULL;
+}
+
+
+static void buddy_init(void) {
+    size_t base = 0;
+    for (int k = MIN_ORDER; k <= MAX_ORDER; k++) {
+        pair_base[k] = base;
+        base += ((BUDDY_MAX_PAGES >> (k + 1)) + 63) / 64 * 64;
+    }
+    assert(base <= PAIR_WORDS * 64);
+    memset(pair_map, 0, sizeof(pair_map));
+    memset(zones, 0, sizeof(zones));
+    nr_zones = 0;
+    huge_pool = NULL;
+    memset(pcp, 0, sizeof(pcp));
+    for (int h = 0; h < NR_HARTS; h++) {
+        spin_lock_init(&pcp[h].lock);
+        list_init(&pcp[h].list);
+    }
+}
+
+static void init_pages(struct Page *base, size_t n) {
     for (size_t i = 0; i < n; i++) {
         struct Page *pp = base + i;
         assert(PageReserved(pp));
@@ -96,37 +392,242 @@ static void buddy_init_memmap(struct Page *base, size_t n) {
         set_page_ref(pp, 0);
         pp->property = 0;
     }
+}
 
-    size_t left = n;
-    size_t cur_idx = (size_t)(base - pages);
-    struct Page *p = base;
+static zone_t *zone_add(const char *name, struct Page *base, size_t n) {
+    assert(nr_zones < MAX_ZONES);
+    zone_t *z = &zones[nr_zones];
+    z->name  = name;
+    z->idx   = 0;
+    for (int i = 0; i < nr_zones; i++) {
+        if (strcmp(zones[i].name, name) == 0) z->idx++;
+    }
+    z->start = (size_t)(base - pages);
+    z->end   = z->start + n;
+    spin_lock_init(&z->lock);
+    for (int k = MIN_ORDER; k <= MAX_ORDER; k++) {
+        for (int mt = 0; mt < MT_TYPES; mt++) list_init(&z->areas[k].free_list[mt]);
+        z->areas[k].nr_free = 0;
+    }
+    for (size_t pb = z->start >> PAGEBLOCK_ORDER; pb <= (z->end - 1) >> PAGEBLOCK_ORDER; pb++) {
+        pb_type[pb] = MT_MOVABLE;
+    }
+    size_t eager = n;
+    if (DEFER_CHUNK > 0) {
+        size_t bound = (z->start / DEFER_UNIT + 1) * DEFER_UNIT;
+        if (bound < z->end) eager = bound - z->start;
+    }
+    init_pages(base, eager);
+    push_range(z, base, eager);
+    z->init_end = z->start + eager;
+
+    int i = nr_zones++;
+    while (i > 0 && zone_order[i - 1]->start > z->start) {
+        zone_order[i] = zone_order[i - 1];
+        i--;
+    }
+    zone_order[i] = z;
+    return z;
+}
 
-    while (left > 0) {
-        int k = ilog2_floor(left);
-        while (k > MIN_ORDER && ((cur_idx & (ORDER_PAGES(k) - 1)) != 0)) k--;
-        size_t sz = ORDER_PAGES(k);
+/* 普通内存建区；还没有大页池且这一段放得下时，先从顶端切出池 */
+static void zone_add_normal(struct Page *base, size_t n) {
+#if HUGE_POOL_PAGES > 0
+    size_t start = (size_t)(base - pages);
+    size_t top   = (start + n) & ~(HUGE_PAGES - 1);
+    if (huge_pool == NULL && top >= start + HUGE_POOL_PAGES) {
+        size_t ps = top - HUGE_POOL_PAGES;
+        if (ps > start) zone_add("Normal", base, ps - start);
+        huge_pool = zone_add("Huge", pages + ps, start + n - ps);
+        huge_pool->is_pool = 1;
+        return;
+    }
+#endif
+    zone_add("Normal", base, n);
+}
 
-        mark_block_head(p, sz);
-        area_push(k, p);
+static void buddy_init_memmap(struct Page *base, size_t n) {
+    assert(n > 0);
+    assert((size_t)(base - pages) + n <= BUDDY_MAX_PAGES);
+#ifdef ZONE_DMA_LIMIT
+    uintptr_t pa = page2pa(base);
+    if (pa < ZONE_DMA_LIMIT) {
+        size_t low = (ZONE_DMA_LIMIT - pa) / PGSIZE;
+        if (low >= n) {
+            zone_add("DMA", base, n);
+            return;
+        }
+        if (low > 0) zone_add("DMA", base, low);
+        base += low;
+        n    -= low;
+    }
+#endif
+    zone_add_normal(base, n);
+}
 
-        p      += sz;
-        cur_idx += sz;
-        left   -= sz;
+/* 块离开空闲表（被分配或被合并）前调用：是延迟留下的块就清标记并计入 *which */
+static inline void lazy_unmark(zone_t *z, struct Page *p, size_t *which) {
+    if (PageLazy(p)) {
+        ClearPageLazy(p);
+        z->lazy_pending--;
+        (*which)++;
     }
 }
 
-static struct Page *buddy_alloc_pages(size_t n) {
-    assert(n > 0);
-    if (n > total_free_pages) return NULL;
+/*
+ * 把区内所有两块都在表里的伙伴对逐阶合并。从低阶往高阶走，
+ * 合出来的块挂到上一阶，轮到那一阶时再继续合。
+ * 伙伴已被分配出去的块合并不了，顺手清掉标记，做完后 lazy_pending 归零。
+ */
+static void zone_coalesce(zone_t *z) {
+    z->coalesce_runs++;
+    for (int k = MIN_ORDER; k < MAX_ORDER; k++) {
+        size_t size = ORDER_PAGES(k);
+        for (int mt = 0; mt < MT_TYPES; mt++) {
+            list_entry_t *head = &z->areas[k].free_list[mt];
+            list_entry_t *le = list_next(head);
+            while (le != head) {
+                struct Page *p = le2page(le, page_link);
+                list_entry_t *next = list_next(le);
+                size_t bidx = buddy_index((size_t)(p - pages), size);
+                /* p 在表里，配对位为 0 即伙伴也在表里 */
+                if (bidx < z->start || bidx >= z->end || pair_test(k, p)) {
+                    if (PageLazy(p)) {
+                        ClearPageLazy(p);
+                        z->lazy_pending--;
+                    }
+                    le = next;
+                    continue;
+                }
+                struct Page *bd = pages + bidx;
+                if (next == &(bd->page_link)) next = list_next(next);
+                area_remove_block(z, k, p);
+                area_remove_block(z, k, bd);
+                lazy_unmark(z, p, &z->lazy_merged);
+                lazy_unmark(z, bd, &z->lazy_merged);
+                clear_block_head(p);
+                clear_block_head(bd);
+                struct Page *lo = bd < p ? bd : p;
+                mark_block_head(lo, size << 1);
+                area_push(z, k + 1, lo);
+                z->merges++;
+                le = next;
+            }
+        }
+    }
+}
 
-    int need_k = ilog2_ceil(n);
-    int src_k = -1;
-    for (int k = need_k; k <= MAX_ORDER; k++) {
-        if (!list_empty(&areas[k].free_list)) { src_k = k; break; }
+/*
+ * 把 blk 开头 2^use_k 页（至少一个 pageblock，至多整块 2^k）覆盖的 pageblock 标成 mt。
+ * blk 已离开空闲表且不小于 pageblock，这些 pageblock 里没有别的空闲块要搬。
+ */
+static void claim_pageblocks(zone_t *z, struct Page *blk, int k, int use_k, int mt) {
+#if MT_GROUPING
+    if (use_k < PAGEBLOCK_ORDER) use_k = PAGEBLOCK_ORDER;
+    if (use_k > k) use_k = k;
+    size_t first = (size_t)(blk - pages) >> PAGEBLOCK_ORDER;
+    for (size_t i = 0; i < ORDER_PAGES(use_k - PAGEBLOCK_ORDER); i++) {
+        if (pb_type[first + i] != mt) {
+            pb_type[first + i] = mt;
+            z->mt_steals++;
+        }
+    }
+#endif
+}
+
+/*
+ * 从别的类型借来的块 blk（2^k 页，小于 pageblock，已摘下并清了块首）：
+ * 所在 pageblock 连同 blk 空闲过半时，把整个 pageblock 改标为 mt，
+ * 里面已空闲的块一并搬到 mt 的链表；否则保持原标签，只借这一块。
+ */
+static void steal_pageblock(zone_t *z, struct Page *blk, int k, int mt) {
+#if MT_GROUPING
+    size_t pb = (size_t)(blk - pages) >> PAGEBLOCK_ORDER;
+    size_t lo = pb << PAGEBLOCK_ORDER, hi = lo + PAGEBLOCK_PAGES;
+    /* 延迟初始化还没碰过的页标志不可信，只扫已初始化的部分 */
+    if (lo < z->start) lo = z->start;
+    if (hi > z->init_end) hi = z->init_end;
+
+    size_t free_cnt = ORDER_PAGES(k);
+    for (size_t i = lo; i < hi;) {
+        struct Page *q = pages + i;
+        if (PageProperty(q)) {
+            free_cnt += q->property;
+            i += q->property;
+        } else {
+            i++;
+        }
+    }
+    if (free_cnt < PAGEBLOCK_PAGES / 2) return;
+
+    pb_type[pb] = mt;
+    z->mt_steals++;
+    for (size_t i = lo; i < hi;) {
+        struct Page *q = pages + i;
+        if (PageProperty(q)) {
+            area_move_type(z, ilog2_floor(q->property), q, mt);
+            i += q->property;
+        } else {
+            i++;
+        }
+    }
+#endif
+}
+
+/*
+ * 为类型 mt 摘一块阶不低于 need_k 的空闲块，阶写入 *kp，块首已清。
+ * 先找本类型最小的合适块（必要时先做一次延迟合并），没有再按 fallback 顺序借别的类型里最大的块，
+ * 借大块能一次把整个 pageblock 划过来，减少以后反复借。
+ * 块不小于 pageblock 时，把要用掉的 2^use_k 页所在的 pageblock 标成 mt。
+ */
+static struct Page *pick_block(zone_t *z, int need_k, int use_k, int mt, int *kp) {
+    uint32_t mask = z->type_mask[mt] & (~0U << need_k);
+    if (mask == 0 && z->lazy_pending > 0) {
+        zone_coalesce(z);
+        mask = z->type_mask[mt] & (~0U << need_k);
     }
-    if (src_k < 0) return NULL;
 
-    struct Page *blk = area_pop(src_k);
+    struct Page *blk = NULL;
+    int k = -1;
+    if (mask != 0) {
+        k = ctz32(mask);
+        blk = area_pop(z, k, mt);
+        lazy_unmark(z, blk, &z->lazy_reused);
+        clear_block_head(blk);
+    } else {
+        for (int i = 0; i < MT_TYPES - 1 && blk == NULL; i++) {
+            int ft = mt_fallback[mt][i];
+            uint32_t fm = z->type_mask[ft] & (~0U << need_k);
+            if (fm == 0) continue;
+            k = ilog2_floor(fm);
+            blk = area_pop(z, k, ft);
+        }
+        if (blk == NULL) return NULL;
+        lazy_unmark(z, blk, &z->lazy_reused);
+        clear_block_head(blk);
+        z->mt_fallbacks++;
+        if (k < PAGEBLOCK_ORDER) steal_pageblock(z, blk, k, mt);
+    }
+    if (k >= PAGEBLOCK_ORDER) claim_pageblocks(z, blk, k, use_k, mt);
+    *kp = k;
+    return blk;
+}
+
+/*
+ * 以下 area_* 只动区 z，调用者持有 z->lock。
+ * area_alloc 取一块不低于 min_k 阶的块，块天然按自身大小对齐，从左半边一路切下来，
+ * 返回的起点就按 2^min_k 页对齐。
+ */
+static struct Page *area_alloc(zone_t *z, size_t n, int min_k, int mt) {
+    assert(n > 0);
+    if (n > z->nr_free) return NULL;
+
+    int need_k = ilog2_ceil(n);
+    if (need_k < min_k) need_k = min_k;
+    if (need_k > MAX_ORDER) return NULL;
+    int src_k;
+    struct Page *blk = pick_block(z, need_k, need_k, mt, &src_k);
+    if (blk == NULL) return NULL;
     size_t blk_sz = ORDER_PAGES(src_k);
 
     while (src_k > MIN_ORDER) {
@@ -134,80 +635,389 @@ static struct Page *buddy_alloc_pages(size_t n) {
         if (half < n) break;
         struct Page *right = blk + half;
         mark_block_head(right, half);
-        area_push(src_k - 1, right);
+        area_push(z, src_k - 1, right);
         src_k--;
         blk_sz = half;
+        z->splits++;
     }
 
     struct Page *ret = blk;
     clear_block_head(blk); 
 
-    size_t remain = blk_sz - n;
-    struct Page *cur = blk + n;
-    size_t cur_idx  = (size_t)(cur - pages);
+    z->splits += push_range(z, blk + n, blk_sz - n);
+    return ret;
+}
 
-    while (remain > 0) {
-        int k = ilog2_floor(remain);
-        while (k > MIN_ORDER && ((cur_idx & (ORDER_PAGES(k) - 1)) != 0)) k--;
-        size_t sz = ORDER_PAGES(k);
-        mark_block_head(cur, sz);
-        area_push(k, cur);
-        cur     += sz;
-        cur_idx += sz;
-        remain  -= sz;
+/* 把第 k 阶的空闲块 cur 与伙伴逐阶合并后入表；伙伴落在区外就停 */
+static void merge_push(zone_t *z, struct Page *cur, int k) {
+    size_t size = ORDER_PAGES(k);
+    mark_block_head(cur, size);
+    while (k < MAX_ORDER) {
+        size_t idx  = (size_t)(cur - pages);
+        size_t bidx = buddy_index(idx, size);
+        if (bidx < z->start || bidx >= z->end) break;
+        if (!pair_test(k, cur)) break;      /* cur 还没入表，位为 1 即伙伴空闲 */
+        struct Page *bd = pages + bidx;
+
+        area_remove_block(z, k, bd);
+        lazy_unmark(z, bd, &z->lazy_merged);
+        clear_block_head(bd);
+        clear_block_head(cur);
+        if (bd < cur) cur = bd;
+        size <<= 1;
+        k++;
+        mark_block_head(cur, size);
+        z->merges++;
     }
-    return ret;
+    area_push(z, k, cur);
 }
 
-static void buddy_free_pages(struct Page *base, size_t n) {
+#if LAZY_HIGH > 0
+/* 延迟模式下的入表：不合并，伙伴空闲时打上 PG_lazy 记账 */
+static void lazy_push(zone_t *z, struct Page *cur, int k) {
+    size_t bidx = buddy_index((size_t)(cur - pages), ORDER_PAGES(k));
+    mark_block_head(cur, ORDER_PAGES(k));
+    if (k < MAX_ORDER && bidx >= z->start && bidx < z->end && pair_test(k, cur)) {
+        SetPageLazy(cur);
+        z->lazy_pending++;
+        z->lazy_deferred++;
+    }
+    area_push(z, k, cur);
+}
+#endif
+
+/*
+ * 已分配区间内部没有块首标记（分配时只清块首，尾部按对齐拆走），
+ * 所以释放只需处理每个对齐块的首页，不再逐页清零。
+ * 从高地址往低地址拆：先还尾部的小块，它们会先和分配时归还的尾巴合并，
+ * 再逐级与前面的大块合并，整段合并次数不超过 MAX_ORDER 加块数。
+ */
+static void area_free(zone_t *z, struct Page *base, size_t n) {
     assert(n > 0);
 
-    struct Page *cur = base;
-    size_t cur_idx  = (size_t)(cur - pages);
+    size_t end  = (size_t)(base - pages) + n;
     size_t left = n;
+    assert((size_t)(base - pages) >= z->start && end <= z->end);
 
     while (left > 0) {
-        int k = ilog2_floor(left);
-        while (k > MIN_ORDER && ((cur_idx & (ORDER_PAGES(k) - 1)) != 0)) k--;
-        size_t part = ORDER_PAGES(k);     
-
-        for (size_t i = 0; i < part; i++) {
-            struct Page *pp = cur + i;
-            assert(!PageReserved(pp));
-            pp->flags = 0;
-            set_page_ref(pp, 0);
-            pp->property = 0;
+        int k = piece_order(end, left);
+        size_t part = ORDER_PAGES(k);
+        end  -= part;
+        left -= part;
+
+        struct Page *cur = pages + end;
+        assert(!PageReserved(cur) && !PageProperty(cur));
+        cur->flags = 0;
+        set_page_ref(cur, 0);
+#if LAZY_HIGH > 0
+        if (z->areas[k].nr_free < LAZY_HIGH) {
+            lazy_push(z, cur, k);
+            continue;
+        }
+#endif
+        merge_push(z, cur, k);
+    }
+}
+
+/* 初始化区内下一段延迟的页并入表，返回页数；调用者持有 z->lock */
+static size_t zone_grow(zone_t *z) {
+    if (z->init_end >= z->end) return 0;
+    size_t next = (z->init_end / DEFER_UNIT + 1) * DEFER_UNIT;
+    if (next > z->end) next = z->end;
+    size_t cnt = next - z->init_end;
+    init_pages(pages + z->init_end, cnt);
+    area_free(z, pages + z->init_end, cnt);
+    z->init_end = next;
+    z->deferred_grows++;
+    return cnt;
+}
+
+/*
+ * 一次分配 count 个 n 页的块：挑一个能装下剩余全部块的最小阶块，
+ * 从头按 n 页步长连续切出，尾部整体按对齐拆回各阶，只做一次分裂。
+ * 内存不够一次装下时退而取能找到的最大块，循环直至凑够或耗尽。
+ */
+static size_t area_alloc_bulk(zone_t *z, size_t n, size_t count, struct Page **out, int mt) {
+    assert(n > 0);
+    int need_k = ilog2_ceil(n);
+    if (need_k > MAX_ORDER) return 0;
+    size_t got = 0;
+
+    while (got < count && n <= z->nr_free) {
+        size_t want = count - got;
+        int want_k = (want * n > ORDER_PAGES(MAX_ORDER)) ? MAX_ORDER : ilog2_ceil(want * n);
+        if (want_k < need_k) want_k = need_k;
+
+        int src_k = -1;
+        uint32_t own = z->type_mask[mt];
+        uint32_t mask = own & (~0U << want_k);
+        if (mask != 0) src_k = ctz32(mask);
+        for (int k = want_k - 1; src_k < 0 && k >= need_k; k--) {
+            if ((own >> k) & 1) src_k = k;
+        }
+
+        struct Page *blk;
+        if (src_k >= 0) {
+            blk = area_pop(z, src_k, mt);
+            lazy_unmark(z, blk, &z->lazy_reused);
+            clear_block_head(blk);
+            if (src_k >= PAGEBLOCK_ORDER) claim_pageblocks(z, blk, src_k, want_k, mt);
+        } else {
+            blk = pick_block(z, need_k, want_k, mt, &src_k);
+            if (blk == NULL) break;
         }
-        mark_block_head(cur, part);
-
-        size_t size = part;
-        int    ok   = k;
-        while (ok < MAX_ORDER) {
-            size_t idx  = (size_t)(cur - pages);
-            size_t bidx = buddy_index(idx, size);
-            if (bidx >= npage) break;
-            struct Page *bd = pages + bidx;
-            if (!PageProperty(bd) || bd->property != size) break;
-
-            area_remove_block(ok, bd);      
-            if (bd < cur) cur = bd;        
-            size <<= 1;
-            ok++;
-            mark_block_head(cur, size);
+        size_t blk_sz = ORDER_PAGES(src_k);
+
+        size_t take = blk_sz / n;
+        if (take > want) take = want;
+        for (size_t i = 0; i < take; i++) out[got++] = blk + i * n;
+        z->splits += push_range(z, blk + take * n, blk_sz - take * n);
+    }
+    return got;
+}
+
+/* ========= 按回退顺序跨区分配，释放回各自的区 ========= */
+static struct Page *zone_alloc_one(zone_t *z, size_t n, int min_k, int mt, int fallback) {
+    spin_lock(&z->lock);
+    struct Page *p = area_alloc(z, n, min_k, mt);
+    while (p == NULL && zone_grow(z) > 0) p = area_alloc(z, n, min_k, mt);
+    if (p != NULL) {
+        z->allocs++;
+        z->mt_allocs[mt]++;
+        if (fallback) z->fallbacks++;
+        if (z->is_pool && min_k < HUGE_ORDER) z->borrowed++;
+    }
+    spin_unlock(&z->lock);
+    return p;
+}
+
+/* 大页请求先试池；普通区按地址从高到低；最后可移动/可回收的请求向池借 */
+static struct Page *zones_alloc(size_t n, int min_k, int mt) {
+    int tried = 0;
+    struct Page *p;
+    if (huge_pool != NULL && min_k >= HUGE_ORDER) {
+        if ((p = zone_alloc_one(huge_pool, n, min_k, mt, 0)) != NULL) return p;
+        tried++;
+    }
+    for (int i = nr_zones - 1; i >= 0; i--) {
+        zone_t *z = zone_order[i];
+        if (z->is_pool) continue;
+        if ((p = zone_alloc_one(z, n, min_k, mt, tried++ > 0)) != NULL) return p;
+    }
+    if (huge_pool != NULL && min_k < HUGE_ORDER && mt != MT_UNMOVABLE) {
+        return zone_alloc_one(huge_pool, n, min_k, mt, 1);
+    }
+    return NULL;
+}
+
+static size_t zone_alloc_bulk(zone_t *z, size_t n, size_t count, struct Page **out,
+                              int mt, int fallback) {
+    spin_lock(&z->lock);
+    size_t m = area_alloc_bulk(z, n, count, out, mt);
+    while (m < count && zone_grow(z) > 0) m += area_alloc_bulk(z, n, count - m, out + m, mt);
+    z->allocs += m;
+    z->mt_allocs[mt] += m;
+    if (fallback) z->fallbacks += m;
+    if (z->is_pool) z->borrowed += m;
+    spin_unlock(&z->lock);
+    return m;
+}
+
+static size_t zones_alloc_bulk(size_t n, size_t count, struct Page **out, int mt) {
+    size_t got = 0;
+    int tried = 0;
+    for (int i = nr_zones - 1; i >= 0 && got < count; i--) {
+        zone_t *z = zone_order[i];
+        if (z->is_pool) continue;
+        got += zone_alloc_bulk(z, n, count - got, out + got, mt, tried++ > 0);
+    }
+    if (huge_pool != NULL && got < count && mt != MT_UNMOVABLE) {
+        got += zone_alloc_bulk(huge_pool, n, count - got, out + got, mt, 1);
+    }
+    return got;
+}
+
+/*
+ * 一次释放 count 个已按地址排好序的 n 页块：同一区内地址连续的块拼成一段再交给
+ * area_free，一段里对齐的部分直接以高阶块入表，
+ * 不必每块各自从低阶一路合并上去。相邻几段落在同一区时只拿一次区锁。
+ */
+static void zones_free_sorted(struct Page **v, size_t n, size_t count) {
+    assert(n > 0);
+    zone_t *z = NULL;
+    size_t i = 0;
+    while (i < count) {
+        struct Page *base = v[i];
+        zone_t *bz = page_zone(base);
+        if (bz != z) {
+            if (z != NULL) spin_unlock(&z->lock);
+            z = bz;
+            spin_lock(&z->lock);
         }
+        size_t len = n;
+        while (++i < count && v[i] == base + len && (size_t)(v[i] - pages) < z->end) len += n;
+        area_free(z, base, len);
+    }
+    if (z != NULL) spin_unlock(&z->lock);
+}
 
+static size_t buddy_alloc_pages_bulk(size_t n, size_t count, struct Page **out) {
+    return zones_alloc_bulk(n, count, out, MT_MOVABLE);
+}
 
-        area_push(ok, cur);
+static void buddy_free_pages_bulk(struct Page **v, size_t n, size_t count) {
+    pmm_sort_blocks(v, count);
+    zones_free_sorted(v, n, count);
+}
 
+/* ========= per-hart 单页缓存 ========= */
+static inline pcp_list_t *this_pcp(void) {
+    int h = cpuid();
+    assert(h >= 0 && h < NR_HARTS);
+    return &pcp[h];
+}
 
-        cur     = (base + (n - (left - part)));
-        cur_idx = (size_t)(cur - pages);
-        left   -= part;
+static size_t pcp_cached(void) {
+    size_t cnt = 0;
+    for (int h = 0; h < NR_HARTS; h++) cnt += pcp[h].count;
+    return cnt;
+}
+
+/* 从缓存尾部摘下最多 cnt 页批量还给伙伴系统；调用者持有 pc->lock */
+static void pcp_drain(pcp_list_t *pc, size_t cnt) {
+    struct Page *batch[PCP_BATCH];
+    while (cnt > 0 && pc->count > 0) {
+        size_t m = 0;
+        while (m < PCP_BATCH && m < cnt && pc->count > 0) {
+            list_entry_t *le = list_prev(&pc->list);
+            list_del(le);
+            pc->count--;
+            batch[m++] = le2page(le, page_link);
+        }
+        cnt -= m;
+        pmm_sort_blocks(batch, m);
+        zones_free_sorted(batch, 1, m);
+        pc->drains++;
     }
 }
 
+static void pcp_drain_all(void) {
+    for (int h = 0; h < NR_HARTS; h++) {
+        spin_lock(&pcp[h].lock);
+        pcp_drain(&pcp[h], pcp[h].count);
+        spin_unlock(&pcp[h].lock);
+    }
+}
+
+static struct Page *pcp_alloc(void) {
+    pcp_list_t *pc = this_pcp();
+    spin_lock(&pc->lock);
+    if (pc->count == 0) {
+        struct Page *batch[PCP_BATCH];
+        size_t got = zones_alloc_bulk(1, PCP_BATCH, batch, MT_MOVABLE);
+        if (got == 0) {
+            spin_unlock(&pc->lock);
+            return NULL;
+        }
+        for (size_t i = 0; i < got; i++) list_add_before(&pc->list, &(batch[i]->page_link));
+        pc->count += got;
+        pc->refills++;
+    } else {
+        pc->hits++;
+    }
+    list_entry_t *le = list_next(&pc->list);
+    list_del(le);
+    pc->count--;
+    spin_unlock(&pc->lock);
+    return le2page(le, page_link);
+}
+
+static void pcp_free(struct Page *p) {
+    pcp_list_t *pc = this_pcp();
+    assert(!PageReserved(p) && !PageProperty(p));
+    /* flags 不在这里清：别的 hart 合并时可能正在读它，等 drain 回伙伴系统时在区锁下清 */
+    set_page_ref(p, 0);
+    spin_lock(&pc->lock);
+    /* 刚释放的页放表头，下一次分配最先拿到，缓存里还是热的 */
+    list_add(&pc->list, &(p->page_link));
+    pc->count++;
+    if (pc->count > PCP_HIGH) pcp_drain(pc, PCP_BATCH);
+    spin_unlock(&pc->lock);
+}
+
+static struct Page *buddy_alloc_pages(size_t n) {
+    assert(n > 0);
+    if (PCP_HIGH > 0 && n == 1) {
+        struct Page *p = pcp_alloc();
+        if (p != NULL) return p;
+    }
+    struct Page *p = zones_alloc(n, 0, MT_MOVABLE);
+    if (p == NULL && pcp_cached() > 0) {
+        pcp_drain_all();
+        p = zones_alloc(n, 0, MT_MOVABLE);
+    }
+    return p;
+}
+
+/* 按类型分配：短期数据走 buddy_alloc_pages（含单页缓存），其余类型直接找各区 */
+static struct Page *buddy_alloc_pages_mt(size_t n, int mt) {
+    assert(n > 0 && mt >= 0 && mt < MT_TYPES);
+    if (!MT_GROUPING || mt == MT_MOVABLE) return buddy_alloc_pages(n);
+    struct Page *p = zones_alloc(n, 0, mt);
+    if (p == NULL && pcp_cached() > 0) {
+        pcp_drain_all();
+        p = zones_alloc(n, 0, mt);
+    }
+    return p;
+}
+
+/*
+ * 起点按 align 页对齐的 n 页（align 为 2 的幂）。pages[] 下标与物理页号只差 nbase，
+ * DRAM 起点 0x80000000 本身 2GiB 对齐，下标对齐即物理地址对齐，可直接拿来做兆页/吉页映射。
+ * 块尾多出的页照常拆回各阶，不浪费。对齐不超过块自身大小时与 alloc_pages 相同。
+ */
+static struct Page *buddy_alloc_pages_aligned(size_t n, size_t align) {
+    assert(n > 0 && align > 0 && (align & (align - 1)) == 0);
+    int min_k = ilog2_floor(align);
+    if (min_k <= ilog2_ceil(n) && min_k < HUGE_ORDER) return buddy_alloc_pages(n);
+    if (min_k > MAX_ORDER) return NULL;
+    int mt = MT_GROUPING ? MT_UNMOVABLE : MT_MOVABLE;   /* 大页映射给内核长期使用 */
+    struct Page *p = zones_alloc(n, min_k, mt);
+    if (p == NULL && pcp_cached() > 0) {
+        pcp_drain_all();
+        p = zones_alloc(n, min_k, mt);
+    }
+    return p;
+}
+
+static void buddy_free_pages(struct Page *base, size_t n) {
+    if (PCP_HIGH > 0 && n == 1) {
+        pcp_free(base);
+        return;
+    }
+    zone_t *z = page_zone(base);
+    spin_lock(&z->lock);
+    area_free(z, base, n);
+    spin_unlock(&z->lock);
+}
+
 static size_t buddy_nr_free_pages(void) {
-    return total_free_pages;
+    size_t cnt = pcp_cached();
+    for (int i = 0; i < nr_zones; i++) cnt += zones[i].nr_free + (zones[i].end - zones[i].init_end);
+    return cnt;
+}
+
+/* 后台初始化：至少做 budget 页（按 chunk 取整）或做完为止，返回实际初始化的页数 */
+static size_t buddy_init_deferred(size_t budget) {
+    size_t done = 0;
+    for (int i = 0; i < nr_zones && done < budget; i++) {
+        zone_t *z = &zones[i];
+        spin_lock(&z->lock);
+        size_t cnt;
+        while (done < budget && (cnt = zone_grow(z)) > 0) done += cnt;
+        spin_unlock(&z->lock);
+    }
+    return done;
 }
 
 
@@ -216,7 +1026,8 @@ static void dump_order_stats(void) {
     cprintf("\n[概览] 剩余空闲页: %lu\n", (unsigned long)remain);
     cprintf("----[按阶统计]----\n");
     for (int k = MIN_ORDER; k <= MAX_ORDER; k++) {
-        size_t cnt = areas[k].nr_free;
+        size_t cnt = 0;
+        for (int i = 0; i < nr_zones; i++) cnt += zones[i].areas[k].nr_free;
         size_t pages_cnt = cnt * ORDER_PAGES(k);
         cprintf("  order=%d  块数=%-4lu  累计页=%lu\n",
                 k, (unsigned long)cnt, (unsigned long)pages_cnt);
@@ -224,30 +1035,157 @@ static void dump_order_stats(void) {
     cprintf("------------------\n");
 }
 
+/*
+ * 每区按类型的分配次数与 pageblock 数（开了分组时），以及各阶的碎片指标（均为千分比）：
+ *   unusable：空闲页里落在小于 2^k 的块中、凑不出一个 2^k 请求的比例；
+ *   extfrag ：Linux 的 fragmentation index，只在没有 2^k 空闲块时有意义，
+ *             接近 1000 说明失败是碎片造成的，接近 0 说明是内存本身不够；有合适块时记为 "-"。
+ */
+static void dump_zone_frag(zone_t *z) {
+    if (MT_GROUPING) {
+        size_t pbs[MT_TYPES] = {0};
+        for (size_t pb = z->start >> PAGEBLOCK_ORDER; pb << PAGEBLOCK_ORDER < z->end; pb++) {
+            pbs[pb_type[pb]]++;
+        }
+        cprintf("  [buddy]   mobility:");
+        for (int mt = 0; mt < MT_TYPES; mt++) {
+            cprintf(" %s allocs=%lu pageblocks=%lu", mt_name[mt],
+                    (unsigned long)z->mt_allocs[mt], (unsigned long)pbs[mt]);
+        }
+        cprintf(" fallbacks=%lu steals=%lu\n",
+                (unsigned long)z->mt_fallbacks, (unsigned long)z->mt_steals);
+    }
+
+    if (z->nr_free == 0) return;
+    size_t blocks = 0;
+    for (int k = MIN_ORDER; k <= MAX_ORDER; k++) blocks += z->areas[k].nr_free;
+    cprintf("  [buddy]   order unusable(%%o) extfrag(%%o):");
+    for (int k = MIN_ORDER; k <= MAX_ORDER; k++) {
+        size_t usable = 0;
+        for (int j = k; j <= MAX_ORDER; j++) {
+            usable += z->areas[j].nr_free * ORDER_PAGES(j);
+        }
+        unsigned long unusable = (unsigned long)((z->nr_free - usable) * 1000 / z->nr_free);
+        if (usable > 0) {
+            cprintf(" %d:%lu/-", k, unusable);
+        } else {
+            long fi = 1000 - (long)((1000 + z->nr_free * 1000 / ORDER_PAGES(k)) / blocks);
+            cprintf(" %d:%lu/%ld", k, unusable, fi);
+        }
+    }
+    cprintf("\n");
+}
+
+static void buddy_dump_stats(void) {
+    size_t hits = 0, refills = 0, drains = 0;
+    for (int h = 0; h < NR_HARTS; h++) {
+        hits    += pcp[h].hits;
+        refills += pcp[h].refills;
+        drains  += pcp[h].drains;
+    }
+    cprintf("  [buddy] pcp: hits=%lu refills=%lu drains=%lu cached=%lu\n",
+            (unsigned long)hits, (unsigned long)refills,
+            (unsigned long)drains, (unsigned long)pcp_cached());
+    for (int i = nr_zones - 1; i >= 0; i--) {
+        zone_t *z = zone_order[i];
+        cprintf("  [buddy] zone %s%d pages=[%lu,%lu) free=%lu allocs=%lu fallbacks=%lu "
+                "splits=%lu merges=%lu\n",
+                z->name, z->idx, (unsigned long)z->start, (unsigned long)z->end,
+                (unsigned long)z->nr_free, (unsigned long)z->allocs,
+                (unsigned long)z->fallbacks, (unsigned long)z->splits,
+                (unsigned long)z->merges);
+        if (z->deferred_grows > 0 || z->init_end < z->end) {
+            cprintf("  [buddy]   deferred init: uninitialized=%lu chunks grown=%lu\n",
+                    (unsigned long)(z->end - z->init_end), (unsigned long)z->deferred_grows);
+        }
+        if (z->is_pool) {
+            size_t mega = 0;
+            for (int k = HUGE_ORDER; k <= MAX_ORDER; k++) {
+                mega += z->areas[k].nr_free << (k - HUGE_ORDER);
+            }
+            cprintf("  [buddy]   huge pool: free megapages=%lu borrowed=%lu\n",
+                    (unsigned long)mega, (unsigned long)z->borrowed);
+        }
+        dump_zone_frag(z);
+        if (LAZY_HIGH > 0) {
+            cprintf("  [buddy]   lazy: merges avoided=%lu splits avoided=%lu "
+                    "deferred=%lu merged later=%lu pending=%lu coalesce runs=%lu\n",
+                    (unsigned long)(z->lazy_deferred - z->lazy_merged),
+                    (unsigned long)z->lazy_reused, (unsigned long)z->lazy_deferred,
+                    (unsigned long)z->lazy_merged, (unsigned long)z->lazy_pending,
+                    (unsigned long)z->coalesce_runs);
+        }
+    }
+}
+
 static void dump_free_lists(void) {
     cprintf("----[free_list 当前状态]----\n");
     cprintf("总空闲页: %lu\n", (unsigned long)buddy_nr_free_pages());
     size_t seq = 1;
-    for (int k = MIN_ORDER; k <= MAX_ORDER; k++) {
-        list_entry_t *head = &areas[k].free_list;
-        list_entry_t *le = head;
-        while ((le = list_next(le)) != head) {
-            struct Page *p = le2page(le, page_link);
-            size_t page_idx = (size_t)(p - pages);
-            cprintf("  块 #%lu: 起始页idx=%lu, 大小=%lu页, order=%d, 物理地址=0x%016lx\n",
-                    (unsigned long)seq++,
-                    (unsigned long)page_idx,
-                    (unsigned long)p->property,
-                    k,
-                    (unsigned long)page2pa(p));
+    for (int i = 0; i < nr_zones; i++) {
+        zone_t *z = zone_order[i];
+        cprintf("  区 %s%d: 页idx [%lu, %lu), 空闲 %lu 页\n", z->name, z->idx,
+                (unsigned long)z->start, (unsigned long)z->end, (unsigned long)z->nr_free);
+        for (int k = MIN_ORDER; k <= MAX_ORDER; k++) {
+            for (int mt = 0; mt < MT_TYPES; mt++) {
+                list_entry_t *head = &z->areas[k].free_list[mt];
+                list_entry_t *le = head;
+                while ((le = list_next(le)) != head) {
+                    struct Page *p = le2page(le, page_link);
+                    size_t page_idx = (size_t)(p - pages);
+                    cprintf("  块 #%lu: 起始页idx=%lu, 大小=%lu页, order=%d, 类型=%s, 物理地址=0x%016lx\n",
+                            (unsigned long)seq++,
+                            (unsigned long)page_idx,
+                            (unsigned long)p->property,
+                            k, mt_name[mt],
+                            (unsigned long)page2pa(p));
+                }
+            }
         }
     }
     cprintf("----------------------------\n");
 }
 
+/*
+ * 核对各区：块都在区内，order_mask/type_mask 与链表一致，块记下的类型就是所在链表的类型，
+ * 伙伴也在区内的块，其配对位应等于“伙伴不在同阶表里”。
+ */
+static void check_pair_maps(void) {
+    for (int i = 0; i < nr_zones; i++) {
+        zone_t *z = &zones[i];
+        size_t free_cnt = 0, lazy_cnt = 0;
+        for (int k = MIN_ORDER; k <= MAX_ORDER; k++) {
+            size_t blocks = 0;
+            for (int mt = 0; mt < MT_TYPES; mt++) {
+                list_entry_t *head = &z->areas[k].free_list[mt];
+                list_entry_t *le = head;
+                assert(((z->type_mask[mt] >> k) & 1) == !list_empty(head));
+                while ((le = list_next(le)) != head) {
+                    struct Page *p = le2page(le, page_link);
+                    size_t idx = (size_t)(p - pages);
+                    assert(PageProperty(p) && p->property == ORDER_PAGES(k));
+                    assert(block_mt(p) == mt);
+                    assert(idx >= z->start && idx + ORDER_PAGES(k) <= z->end);
+                    blocks++;
+                    free_cnt += ORDER_PAGES(k);
+                    lazy_cnt += PageLazy(p) ? 1 : 0;
+                    size_t bidx = buddy_index(idx, ORDER_PAGES(k));
+                    if (bidx < z->start || bidx >= z->end) continue;
+                    int buddy_free = PageProperty(pages + bidx) &&
+                                     pages[bidx].property == ORDER_PAGES(k);
+                    assert(pair_test(k, p) == !buddy_free);
+                }
+            }
+            assert(blocks == z->areas[k].nr_free);
+            assert(((z->order_mask >> k) & 1) == (blocks != 0));
+        }
+        assert(free_cnt == z->nr_free && lazy_cnt == z->lazy_pending);
+    }
+}
 
 static void buddy_check(void) {
     cprintf("[buddy] 基本检查开始...\n");
+    check_pair_maps();
 
     struct Page *a = buddy_alloc_pages(1);
     struct Page *b = buddy_alloc_pages(1);
@@ -255,6 +1193,46 @@ static void buddy_check(void) {
     buddy_free_pages(a, 1);
     buddy_free_pages(b, 1);
 
+    size_t before = buddy_nr_free_pages();
+    struct Page *batch[32];
+    size_t got = buddy_alloc_pages_bulk(1, 32, batch);
+    assert(got == 32 && buddy_nr_free_pages() == before - 32);
+    for (int i = 1; i < 32; i++) assert(batch[i] == batch[0] + i);
+    buddy_free_pages_bulk(batch, 1, got);
+    assert(buddy_nr_free_pages() == before);
+    check_pair_maps();
+
+    /* 不可移动页：要么落在已改标为 UNMOVABLE 的 pageblock，要么只是借来的零星块 */
+    size_t steals = 0, fallbacks = 0;
+    for (int i = 0; i < nr_zones; i++) {
+        steals    += zones[i].mt_steals;
+        fallbacks += zones[i].mt_fallbacks;
+    }
+    struct Page *u = buddy_alloc_pages_mt(1, MT_UNMOVABLE);
+    assert(u != NULL && buddy_nr_free_pages() == before - 1);
+    if (MT_GROUPING && pb_mt(u) != MT_UNMOVABLE) {
+        size_t steals2 = 0, fallbacks2 = 0;
+        for (int i = 0; i < nr_zones; i++) {
+            steals2    += zones[i].mt_steals;
+            fallbacks2 += zones[i].mt_fallbacks;
+        }
+        assert(fallbacks2 > fallbacks && steals2 == steals);
+    }
+    buddy_free_pages(u, 1);
+    assert(buddy_nr_free_pages() == before);
+    check_pair_maps();
+
+    /* 对齐分配：起点对齐，块尾多出的页都还在空闲表里 */
+    if (HUGE_ORDER <= MAX_ORDER) {
+        struct Page *h = buddy_alloc_pages_aligned(3, HUGE_PAGES);
+        assert(h != NULL && (((size_t)(h - pages)) & (HUGE_PAGES - 1)) == 0);
+        assert(buddy_nr_free_pages() == before - 3);
+        if (huge_pool != NULL) assert(page_zone(h) == huge_pool);
+        buddy_free_pages(h, 3);
+        assert(buddy_nr_free_pages() == before);
+        check_pair_maps();
+    }
+
     cprintf("[buddy] 基本功能检测通过，nr_free=%lu\n",
             (unsigned long)buddy_nr_free_pages());
 
@@ -297,13 +1275,13 @@ cprintf("\n[阶段3] 释放 2和3 页后：\n");
 dump_order_stats();     
 dump_free_lists();     
 
-free_pages(b1, 4096);
+if (b1) free_pages(b1, 4096);
 cprintf("\n[阶段3] 释放 4096 页后：\n");
 dump_order_stats();
 dump_free_lists();
 
 
-free_pages(b2, 8192);
+if (b2) free_pages(b2, 8192);
 
 
 size_t want_all = nr_free_pages();
@@ -312,6 +1290,7 @@ cprintf("[阶段3] 全部分配: 请求=%lu页  结果=%s\n", want_all, all ? "
 if (all) {
     free_pages(all, want_all);
 }
+check_pair_maps();
 
 
 cprintf("\n=== 阶段3：回收后总体状态 ===\n");
@@ -332,6 +1311,12 @@ const struct pmm_manager buddy_pmm_manager = {
     .init_memmap    = buddy_init_memmap,
     .alloc_pages    = buddy_alloc_pages,
     .free_pages     = buddy_free_pages,
+    .alloc_pages_bulk = buddy_alloc_pages_bulk,
+    .free_pages_bulk  = buddy_free_pages_bulk,
     .nr_free_pages  = buddy_nr_free_pages,
     .check          = buddy_check,
+    .dump_stats     = buddy_dump_stats,
+    .alloc_pages_mt = buddy_alloc_pages_mt,
+    .alloc_pages_aligned = buddy_alloc_pages_aligned,
+    .init_deferred  = buddy_init_deferred,
 };
@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <pmm.h>
+#include <pmm_bulk.h>
+#include <smp.h>
+#include "host_pmm.h"
+
+/*
+ * pmm 基准：维护一个最多 live 组的活跃集合，每一步随机地分配一组或释放一组，
+ * 分别统计 alloc/free 的吞吐与延迟分位数。块大小由 -d 指定的分布产生。
+ * 每组默认 1 块，走 alloc_pages/free_pages；-b B 时每组 B 块同样大小的块，
+ * 走 alloc_pages_bulk/free_pages_bulk，延迟按调用计，吞吐按块计。
+ *
+ *   bench [-m 管理器|all] [-n 页数] [-o 操作数] [-l 活跃组数] [-b 批大小]
+ *         [-d 分布] [-s 种子] [-t 线程数] [-z 内存段数] [-u K] [-i] [-c]
+ *
+ * 分布：
+ *   fixed:K        每次 K 页
+ *   uniform:A:B    [A, B] 内均匀
+ *   pow2:K         2^0 .. 2^K 页，阶数均匀
+ *   mix            90% 1 页，9% 2..16 页，1% 17..256 页
+ *
+ * -z Z 把页均分成 Z 段分别 init_memmap，模拟多个 DTB 内存节点（伙伴系统会建 Z 个区）。
+ * -u K 模拟长期驻留的内核对象：每 K 步额外用 alloc_pages_mt(1, MT_UNMOVABLE) 钉住一页直到最后，
+ * 负载结束、短期组都还回去后，看还能用 alloc_pages_aligned 分出多少个兆页（PROBE_PAGES 页且对齐），
+ * 衡量不可移动页把内存钉碎的程度。
+ * init 为建 Page 数组在内的总耗时，memmap 只算管理器的 init/init_memmap。管理器推迟了部分
+ * struct Page 的初始化时，剩下的在负载里按需完成；-i 则在负载开始前一次做完（相当于空闲 hart 在后台做），
+ * 并单独报告这部分耗时。
+ * -t T 时改测多 hart 扩展性：依次用 1..T 个线程（每个线程扮演一个 hart）
+ * 并发跑同样的负载，各线程分摊操作数与活跃组数，只报告总的墙钟吞吐。
+ *
+ * 用 perf 剖析时直接 perf record ./bin/bench -m buddy ... 即可。
+ */
+
+#define DEFAULT_NPAGES  32256       /* 与 QEMU virt 128MiB 下可用页数相当 */
+#define DEFAULT_OPS     1000000
+#define DEFAULT_LIVE    1024
+#define PROBE_PAGES     512         /* -u 下探测用的大块：一个 Sv39 兆页 */
+
+enum dist_kind { DIST_FIXED, DIST_UNIFORM, DIST_POW2, DIST_MIX };
+
+struct dist {
+    enum dist_kind kind;
+    size_t a, b;
+    const char *spec;
+};
+
+struct group {
+    struct Page **v;            /* 指向 batch 个槽位，随组一起交换，不会共用 */
+    size_t n, cnt;
+};
+
+struct lat {
+    uint32_t *ns;
+    size_t cnt;
+    size_t blocks;
+    uint64_t sum;
+    size_t fail;
+};
+
+/* ========= 随机数（xorshift64*，保证各管理器拿到同一序列） ========= */
+static __thread uint64_t rng_state;
+
+static inline uint64_t rng_next(void) {
+    uint64_t x = rng_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng_state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static inline size_t rng_range(size_t lo, size_t hi) {
+    return lo + (size_t)(rng_next() % (hi - lo + 1));
+}
+
+static size_t dist_sample(const struct dist *d) {
+    switch (d->kind) {
+    case DIST_FIXED:
+        return d->a;
+    case DIST_UNIFORM:
+        return rng_range(d->a, d->b);
+    case DIST_POW2:
+        return (size_t)1 << rng_range(0, d->a);
+    case DIST_MIX: {
+        size_t r = rng_next() % 100;
+        if (r < 90) return 1;
+        if (r < 99) return rng_range(2, 16);
+        return rng_range(17, 256);
+    }
+    }
+    return 1;
+}
+
+static int dist_parse(const char *s, struct dist *d) {
+    unsigned long a, b;
+    d->spec = s;
+    if (strcmp(s, "mix") == 0) {
+        d->kind = DIST_MIX;
+        return 0;
+    }
+    if (sscanf(s, "fixed:%lu", &a) == 1 && a > 0) {
+        d->kind = DIST_FIXED;
+        d->a = a;
+        return 0;
+    }
+    if (sscanf(s, "uniform:%lu:%lu", &a, &b) == 2 && a > 0 && a <= b) {
+        d->kind = DIST_UNIFORM;
+        d->a = a;
+        d->b = b;
+        return 0;
+    }
+    if (sscanf(s, "pow2:%lu", &a) == 1 && a < 32) {
+        d->kind = DIST_POW2;
+        d->a = a;
+        return 0;
+    }
+    return -1;
+}
+
+/* ========= 计时与统计 ========= */
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline void lat_record(struct lat *l, uint64_t ns, size_t blocks) {
+    l->ns[l->cnt++] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+    l->sum += ns;
+    l->blocks += blocks;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const struct lat *l, double q) {
+    size_t i = (size_t)(q * (double)(l->cnt - 1) + 0.5);
+    return l->ns[i];
+}
+
+static void lat_report(const char *what, struct lat *l) {
+    if (l->cnt == 0) {
+        printf("  %-5s     0 ops\n", what);
+        return;
+    }
+    qsort(l->ns, l->cnt, sizeof(l->ns[0]), cmp_u32);
+    double blk_per_sec = l->sum ? (double)l->blocks * 1e9 / (double)l->sum : 0.0;
+    printf("  %-5s %9lu ops  %12.0f blk/s  fail=%lu  "
+           "p50=%u p90=%u p99=%u p99.9=%u max=%u ns\n",
+           what, (unsigned long)l->cnt, blk_per_sec, (unsigned long)l->fail,
+           percentile(l, 0.50), percentile(l, 0.90), percentile(l, 0.99),
+           percentile(l, 0.999), l->ns[l->cnt - 1]);
+}
+
+/* ========= 工作负载 ========= */
+static size_t group_alloc(struct group *g, size_t n, size_t batch) {
+    g->n = n;
+    if (batch == 1) {
+        g->v[0] = alloc_pages(n);
+        g->cnt = g->v[0] != NULL;
+    } else {
+        g->cnt = alloc_pages_bulk(n, batch, g->v);
+    }
+    return g->cnt;
+}
+
+static void group_free(struct group *g) {
+    if (g->cnt == 1) {
+        free_pages(g->v[0], g->n);
+    } else {
+        free_pages_bulk(g->v, g->n, g->cnt);
+    }
+}
+
+/* 钉住的页都还回去之前，数一数还能分出多少个对齐的兆页，分完立即归还 */
+static size_t probe_contig(size_t npages) {
+    size_t cap = npages / PROBE_PAGES + 1, got = 0;
+    struct Page **v = calloc(cap, sizeof(*v));
+    if (!v) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    while (got < cap && (v[got] = alloc_pages_aligned(PROBE_PAGES, PROBE_PAGES)) != NULL) {
+        got++;
+    }
+    for (size_t i = 0; i < got; i++) {
+        free_pages(v[i], PROBE_PAGES);
+    }
+    free(v);
+    return got;
+}
+
+static void run_one(const struct pmm_manager *m, size_t npages, int nranges, size_t ops,
+                    size_t live_max, size_t batch, const struct dist *d,
+                    uint64_t seed, size_t pin_every, int init_all, int check) {
+    struct group *live = calloc(live_max, sizeof(*live));
+    struct Page **slots = calloc(live_max * batch, sizeof(*slots));
+    struct lat la = { .ns = calloc(ops, sizeof(uint32_t)) };
+    struct lat lf = { .ns = calloc(ops, sizeof(uint32_t)) };
+    struct Page **pinned = calloc(pin_every ? ops / pin_every + 1 : 1, sizeof(*pinned));
+    if (!live || !slots || !la.ns || !lf.ns || !pinned) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < live_max; i++) {
+        live[i].v = slots + i * batch;
+    }
+
+    uint64_t t0 = now_ns();
+    uint64_t t_memmap = pmm_host_init(m, npages, nranges);
+    uint64_t t_init = now_ns() - t0;
+    uint64_t t_deferred = 0;
+    size_t n_deferred = 0;
+    if (init_all) {
+        t0 = now_ns();
+        n_deferred = pmm_init_deferred((size_t)-1);
+        t_deferred = now_ns() - t0;
+    }
+    size_t total = nr_free_pages();
+    rng_state = seed ? seed : 1;
+
+    size_t nlive = 0, npinned = 0;
+    for (size_t i = 0; i < ops; i++) {
+        if (pin_every && i % pin_every == pin_every - 1) {
+            struct Page *p = alloc_pages_mt(1, MT_UNMOVABLE);
+            if (p != NULL) pinned[npinned++] = p;
+        }
+        int do_alloc = nlive == 0 || (nlive < live_max && (rng_next() & 1));
+        if (do_alloc) {
+            size_t n = dist_sample(d);
+            uint64_t s = now_ns();
+            size_t got = group_alloc(&live[nlive], n, batch);
+            lat_record(&la, now_ns() - s, got);
+            if (got == batch) {
+                nlive++;
+                continue;
+            }
+            // 批量分配只拿到一部分时也算失败，拿到的先还回去
+            la.fail++;
+            if (got > 0) group_free(&live[nlive]);
+            if (nlive == 0) continue;
+        }
+        size_t k = rng_range(0, nlive - 1);
+        struct group g = live[k];
+        live[k] = live[--nlive];
+        live[nlive] = g;
+        uint64_t s = now_ns();
+        group_free(&g);
+        lat_record(&lf, now_ns() - s, g.cnt);
+    }
+
+    while (nlive > 0) {
+        group_free(&live[--nlive]);
+    }
+    assert(nr_free_pages() == total - npinned);
+
+    printf("%s: npages=%lu ops=%lu live=%lu batch=%lu dist=%s seed=%lu init=%lu us memmap=%lu us\n",
+           m->name, (unsigned long)npages, (unsigned long)ops,
+           (unsigned long)live_max, (unsigned long)batch, d->spec,
+           (unsigned long)seed, (unsigned long)(t_init / 1000),
+           (unsigned long)(t_memmap / 1000));
+    if (init_all) {
+        printf("  deferred init: %lu pages in %lu us\n",
+               (unsigned long)n_deferred, (unsigned long)(t_deferred / 1000));
+    }
+    lat_report("alloc", &la);
+    lat_report("free", &lf);
+    if (pin_every) {
+        size_t probe = probe_contig(npages);
+        printf("  pinned %lu unmovable pages, aligned %lu-page megapages still available: %lu\n",
+               (unsigned long)npinned, (unsigned long)PROBE_PAGES, (unsigned long)probe);
+    }
+    if (m->dump_stats != NULL) {
+        m->dump_stats();
+    }
+    for (size_t i = 0; i < npinned; i++) {
+        free_pages(pinned[i], 1);
+    }
+    assert(nr_free_pages() == total);
+
+    if (check) {
+        pmm_manager->check();
+    }
+
+    pmm_host_fini();
+    free(pinned);
+    free(la.ns);
+    free(lf.ns);
+    free(slots);
+    free(live);
+}
+
+/* ========= 多线程扩展性 ========= */
+struct worker {
+    pthread_t tid;
+    int hart;
+    size_t ops, live_max, batch;
+    const struct dist *d;
+    uint64_t seed;
+    size_t done, fail;
+};
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct group *live = calloc(w->live_max, sizeof(*live));
+    struct Page **slots = calloc(w->live_max * w->batch, sizeof(*slots));
+    if (!live || !slots) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < w->live_max; i++) {
+        live[i].v = slots + i * w->batch;
+    }
+    host_hart_id = w->hart;
+    rng_state = w->seed;
+
+    size_t nlive = 0;
+    for (size_t i = 0; i < w->ops; i++) {
+        int do_alloc = nlive == 0 || (nlive < w->live_max && (rng_next() & 1));
+        if (do_alloc) {
+            size_t got = group_alloc(&live[nlive], dist_sample(w->d), w->batch);
+            w->done += got;
+            if (got == w->batch) {
+                nlive++;
+                continue;
+            }
+            w->fail++;
+            if (got > 0) group_free(&live[nlive]);
+            if (nlive == 0) continue;
+        }
+        size_t k = rng_range(0, nlive - 1);
+        struct group g = live[k];
+        live[k] = live[--nlive];
+        live[nlive] = g;
+        group_free(&g);
+        w->done += g.cnt;
+    }
+    while (nlive > 0) {
+        group_free(&live[--nlive]);
+    }
+    free(slots);
+    free(live);
+    return NULL;
+}
+
+static void run_threads(const struct pmm_manager *m, size_t npages, int nranges, size_t ops,
+                        size_t live_max, size_t batch, const struct dist *d,
+                        uint64_t seed, int nthreads, int check) {
+    struct worker w[NR_HARTS];
+    pmm_host_init(m, npages, nranges);
+    size_t total = nr_free_pages();
+
+    printf("%s: npages=%lu ops=%lu live=%lu batch=%lu dist=%s seed=%lu threads=1..%d\n",
+           m->name, (unsigned long)npages, (unsigned long)ops,
+           (unsigned long)live_max, (unsigned long)batch, d->spec,
+           (unsigned long)seed, nthreads);
+    for (int t = 1; t <= nthreads; t++) {
+        size_t live_each = live_max / t ? live_max / t : 1;
+        uint64_t s = now_ns();
+        for (int i = 0; i < t; i++) {
+            w[i] = (struct worker){
+                .hart = i, .ops = ops / t, .live_max = live_each, .batch = batch,
+                .d = d, .seed = (seed ? seed : 1) + i,
+            };
+            if (pthread_create(&w[i].tid, NULL, worker_main, &w[i]) != 0) {
+                fprintf(stderr, "bench: pthread_create failed\n");
+                exit(1);
+            }
+        }
+        size_t done = 0, fail = 0;
+        for (int i = 0; i < t; i++) {
+            pthread_join(w[i].tid, NULL);
+            done += w[i].done;
+            fail += w[i].fail;
+        }
+        uint64_t el = now_ns() - s;
+        assert(nr_free_pages() == total);
+        printf("  threads=%d %12.0f blk/s  fail=%lu  wall=%lu us\n",
+               t, el ? (double)done * 1e9 / (double)el : 0.0,
+               (unsigned long)fail, (unsigned long)(el / 1000));
+    }
+    if (m->dump_stats != NULL) {
+        m->dump_stats();
+    }
+    if (check) {
+        pmm_manager->check();
+    }
+    pmm_host_fini();
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-m manager|all] [-n npages] [-o ops] [-l live] "
+            "[-b batch] [-d dist] [-s seed] [-t threads] [-z ranges] [-u K] [-i] [-c]\n"
+            "  manager: best_fit | buddy | bitmap | tlsf | all (default all)\n"
+            "  dist:    fixed:K | uniform:A:B | pow2:K | mix (default mix)\n"
+            "  -b       blocks per group; > 1 uses the bulk API (default 1)\n"
+            "  -t       scale from 1 to T threads and report aggregate throughput\n"
+            "  -z       split memory into Z init_memmap ranges (default 1)\n"
+            "  -u       pin one unmovable page every K ops, then probe for large blocks\n"
+            "  -i       finish deferred struct Page init before the workload and time it\n"
+            "  -c       run the manager's check() after the workload\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *mname = "all";
+    size_t npages = DEFAULT_NPAGES, ops = DEFAULT_OPS, live = DEFAULT_LIVE, batch = 1, pin = 0;
+    uint64_t seed = 1;
+    int check = 0, threads = 0, nranges = 1, init_all = 0, c;
+    struct dist d;
+    dist_parse("mix", &d);
+
+    while ((c = getopt(argc, argv, "m:n:o:l:b:d:s:t:z:u:ich")) != -1) {
+        switch (c) {
+        case 'm': mname = optarg; break;
+        case 'n': npages = strtoul(optarg, NULL, 0); break;
+        case 'o': ops = strtoul(optarg, NULL, 0); break;
+        case 'l': live = strtoul(optarg, NULL, 0); break;
+        case 'b': batch = strtoul(optarg, NULL, 0); break;
+        case 'd': if (dist_parse(optarg, &d) != 0) usage(argv[0]); break;
+        case 's': seed = strtoull(optarg, NULL, 0); break;
+        case 't': threads = atoi(optarg); break;
+        case 'z': nranges = atoi(optarg); break;
+        case 'u': pin = strtoul(optarg, NULL, 0); break;
+        case 'i': init_all = 1; break;
+        case 'c': check = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (npages == 0 || ops == 0 || live == 0 || batch == 0) usage(argv[0]);
+    if (threads < 0 || threads > NR_HARTS) usage(argv[0]);
+    if (nranges <= 0 || (size_t)nranges > npages) usage(argv[0]);
+
+    if (strcmp(mname, "all") == 0) {
+        const struct pmm_manager *m;
+        for (int i = 0; (m = pmm_manager_at(i)) != NULL; i++) {
+            if (threads > 0) run_threads(m, npages, nranges, ops, live, batch, &d, seed, threads, check);
+            else run_one(m, npages, nranges, ops, live, batch, &d, seed, pin, init_all, check);
+        }
+        return 0;
+    }
+
+    const struct pmm_manager *m = pmm_lookup(mname);
+    if (m == NULL) {
+        fprintf(stderr, "bench: unknown manager '%s'\n", mname);
+        usage(argv[0]);
+    }
+    if (threads > 0) run_threads(m, npages, nranges, ops, live, batch, &d, seed, threads, check);
+    else run_one(m, npages, nranges, ops, live, batch, &d, seed, pin, init_all, check);
+    return 0;
+}
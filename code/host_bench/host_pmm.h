@@ -0,0 +1,18 @@
+#ifndef __HOST_BENCH_HOST_PMM_H__
+#define __HOST_BENCH_HOST_PMM_H__
+
+#include <pmm.h>
+
+/*
+ * 宿主机上替代内核 pmm_init 的部分：分配 Page 数组并交给指定的 pmm_manager。
+ * nranges > 1 时把页均分成几段分别 init_memmap，模拟 DTB 里有多个内存节点。
+ */
+const struct pmm_manager *pmm_lookup(const char *name);
+const struct pmm_manager *pmm_manager_at(int i);
+/* 返回 init 与各段 init_memmap 的耗时（ns），不含 Page 数组本身的分配与置 PG_reserved */
+uint64_t pmm_host_init(const struct pmm_manager *m, size_t n, int nranges);
+/* 给 pages[] 配上真正的内存（MAP_NORESERVE，用到才占），page2pa + va_pa_offset 就能读写；slub 基准要用 */
+void pmm_host_backing(void);
+void pmm_host_fini(void);
+
+#endif /* !__HOST_BENCH_HOST_PMM_H__ */
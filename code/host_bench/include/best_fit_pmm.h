@@ -0,0 +1,8 @@
+#ifndef __KERN_MM_BEST_FIT_PMM_H__
+#define  __KERN_MM_BEST_FIT_PMM_H__
+
+#include <pmm.h>
+
+extern const struct pmm_manager best_fit_pmm_manager;
+
+#endif /* ! __KERN_MM_BEST_FIT_PMM_H__ */
@@ -0,0 +1,15 @@
+#ifndef __LIBS_DEFS_H__
+#define __LIBS_DEFS_H__
+
+/* 宿主机构建用的 defs.h：用系统头提供定宽整数，其余与内核版保持一致 */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uintptr_t ppn_t;
+
+/* 由成员指针求外层结构体指针 */
+#define to_struct(ptr, type, member)                               \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#endif /* !__LIBS_DEFS_H__ */
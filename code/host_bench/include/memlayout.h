@@ -0,0 +1,42 @@
+#ifndef __KERN_MM_MEMLAYOUT_H__
+#define __KERN_MM_MEMLAYOUT_H__
+
+/* 宿主机构建用的 memlayout.h：struct Page 与页标志位和内核版一致 */
+#include <defs.h>
+#include <list.h>
+
+#define PGSIZE          4096
+#define PGSHIFT         12
+
+struct Page {
+    int ref;                        // page frame's reference counter
+    uint64_t flags;                 // array of flags that describe the status of the page frame
+    unsigned int property;          // the num of free block, used in first fit pm manager
+    list_entry_t page_link;         // free list link
+};
+
+/* Flags describing the status of a page frame */
+#define PG_reserved                 0
+#define PG_property                 1
+
+/* 单线程宿主机上不需要原子指令 */
+static inline void set_bit(int nr, volatile uint64_t *addr) { *addr |= (uint64_t)1 << nr; }
+static inline void clear_bit(int nr, volatile uint64_t *addr) { *addr &= ~((uint64_t)1 << nr); }
+static inline bool test_bit(int nr, volatile uint64_t *addr) { return (*addr >> nr) & 1; }
+
+#define SetPageReserved(page)       set_bit(PG_reserved, &((page)->flags))
+#define ClearPageReserved(page)     clear_bit(PG_reserved, &((page)->flags))
+#define PageReserved(page)          test_bit(PG_reserved, &((page)->flags))
+#define SetPageProperty(page)       set_bit(PG_property, &((page)->flags))
+#define ClearPageProperty(page)     clear_bit(PG_property, &((page)->flags))
+#define PageProperty(page)          test_bit(PG_property, &((page)->flags))
+
+#define le2page(le, member)                 \
+    to_struct((le), struct Page, member)
+
+typedef struct {
+    list_entry_t free_list;         // the list header
+    unsigned int nr_free;           // number of free pages in this free list
+} free_area_t;
+
+#endif /* !__KERN_MM_MEMLAYOUT_H__ */
@@ -0,0 +1,10 @@
+#ifndef __KERN_MM_MMU_H__
+#define __KERN_MM_MMU_H__
+
+/* 宿主机构建用的 mmu.h：没有页表，只给出与内核版相同的页大小与取整宏 */
+#include <memlayout.h>
+
+#define ROUNDDOWN(a, n) ((uintptr_t)(a) & ~((uintptr_t)(n) - 1))
+#define ROUNDUP(a, n)   ((((uintptr_t)(a) + (n) - 1)) & ~((uintptr_t)(n) - 1))
+
+#endif /* !__KERN_MM_MMU_H__ */
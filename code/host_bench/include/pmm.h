@@ -0,0 +1,78 @@
+#ifndef __KERN_MM_PMM_H__
+#define __KERN_MM_PMM_H__
+
+/* 宿主机构建用的 pmm.h：pmm_manager 接口与内核版一致，pages/npage 由基准程序提供 */
+#include <assert.h>
+#include <defs.h>
+#include <memlayout.h>
+
+/*
+ * 分配类型（按寿命/可回收性分组）：长期驻留的内核页（slab 等）、可回收的缓存、
+ * 短期数据。支持分组的管理器把不同类型摆进不同的 pageblock，减少大块被零星长期页钉住。
+ */
+enum page_mt {
+    MT_UNMOVABLE,
+    MT_RECLAIMABLE,
+    MT_MOVABLE,
+    MT_TYPES,
+};
+
+struct pmm_manager {
+    const char *name;
+    void (*init)(void);
+    void (*init_memmap)(struct Page *base, size_t n);
+    struct Page *(*alloc_pages)(size_t n);
+    void (*free_pages)(struct Page *base, size_t n);
+    // 一次分配 count 个 n 页的块写入 out[]，返回实际分配到的块数
+    size_t (*alloc_pages_bulk)(size_t n, size_t count, struct Page **out);
+    // 一次释放 count 个 n 页的块；会就地按地址重排 blocks[]
+    void (*free_pages_bulk)(struct Page **blocks, size_t n, size_t count);
+    size_t (*nr_free_pages)(void);
+    void (*check)(void);
+    // 可选：打印管理器内部的统计计数
+    void (*dump_stats)(void);
+    // 可选：按分配类型分配；为 NULL 时 alloc_pages_mt 退回 alloc_pages
+    struct Page *(*alloc_pages_mt)(size_t n, int mt);
+    // 可选：起点按 align 页（2 的幂）对齐的 n 页；为 NULL 时只有 alloc_pages 碰巧对齐才成功
+    struct Page *(*alloc_pages_aligned)(size_t n, size_t align);
+    // 可选：init_memmap 推迟了部分 struct Page 时，由空闲 hart 提前初始化至少 budget 页，返回实际页数
+    size_t (*init_deferred)(size_t budget);
+};
+
+extern const struct pmm_manager *pmm_manager;
+
+struct Page *alloc_pages(size_t n);
+struct Page *alloc_pages_mt(size_t n, int mt);
+struct Page *alloc_pages_aligned(size_t n, size_t align);
+void free_pages(struct Page *base, size_t n);
+size_t nr_free_pages(void);
+size_t pmm_init_deferred(size_t budget);
+
+#define alloc_page() alloc_pages(1)
+#define free_page(page) free_pages(page, 1)
+
+extern struct Page *pages;
+extern size_t npage;
+extern const size_t nbase;
+extern uint64_t va_pa_offset;
+
+static inline ppn_t page2ppn(struct Page *page) { return page - pages + nbase; }
+
+static inline uintptr_t page2pa(struct Page *page) {
+    return page2ppn(page) << PGSHIFT;
+}
+
+/* 宿主机上 pa 就是 (下标 << PGSHIFT)；va_pa_offset 由 pmm_host_backing 指向真正的后备内存 */
+#define PADDR(kva) ((uintptr_t)(kva) - (uintptr_t)va_pa_offset)
+#define KADDR(pa)  ((void *)((uintptr_t)(pa) + (uintptr_t)va_pa_offset))
+
+static inline struct Page *pa2page(uintptr_t pa) {
+    assert((pa >> PGSHIFT) - nbase < npage);
+    return &pages[(pa >> PGSHIFT) - nbase];
+}
+
+static inline int page_ref(struct Page *page) { return page->ref; }
+
+static inline void set_page_ref(struct Page *page, int val) { page->ref = val; }
+
+#endif /* !__KERN_MM_PMM_H__ */
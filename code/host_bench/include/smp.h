@@ -0,0 +1,18 @@
+#ifndef __HOST_BENCH_SMP_H__
+#define __HOST_BENCH_SMP_H__
+
+/*
+ * 宿主机版 smp.h：每个基准线程扮演一个 hart，hartid 放在线程局部变量里，
+ * 由 bench 在线程启动时设置；主线程为 0。
+ */
+#ifndef NR_HARTS
+#define NR_HARTS 8
+#endif
+
+extern __thread int host_hart_id;
+
+static inline int cpuid(void) {
+    return host_hart_id;
+}
+
+#endif /* !__HOST_BENCH_SMP_H__ */
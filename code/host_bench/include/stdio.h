@@ -0,0 +1,9 @@
+#ifndef __HOST_BENCH_STDIO_H__
+#define __HOST_BENCH_STDIO_H__
+
+/* 内核的 cprintf 在宿主机上直接落到 printf */
+#include_next <stdio.h>
+
+#define cprintf printf
+
+#endif /* !__HOST_BENCH_STDIO_H__ */
@@ -0,0 +1,8 @@
+#ifndef __KERN_SYNC_SYNC_H__
+#define __KERN_SYNC_SYNC_H__
+
+/* 宿主机上没有中断可关，local_intr_save/restore 只保留形状 */
+#define local_intr_save(x)      do { (x) = 0; } while (0)
+#define local_intr_restore(x)   do { (void)(x); } while (0)
+
+#endif /* !__KERN_SYNC_SYNC_H__ */
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <pmm.h>
+#include <best_fit_pmm.h>
+#include <buddy_pmm.h>
+#include <bitmap_pmm.h>
+#include <tlsf_pmm.h>
+#include <smp.h>
+#include "host_pmm.h"
+
+/*
+ * 宿主机版 pmm.c：内核里由 pmm_init 根据 DTB 建立 pages[]，这里直接 calloc 一段
+ * Page 数组。nbase 取 0，使 pages[i] 的下标、ppn 与 npage 三者一致，各管理器里
+ * 用 npage 或 npage - nbase 做边界判断都能得到同一个结果。
+ */
+struct Page *pages;
+size_t npage = 0;
+const size_t nbase = 0;
+uint64_t va_pa_offset = 0;
+const struct pmm_manager *pmm_manager;
+__thread int host_hart_id;
+
+static const struct pmm_manager *const managers[] = {
+    &best_fit_pmm_manager,
+    &buddy_pmm_manager,
+    &bitmap_pmm_manager,
+    &tlsf_pmm_manager,
+};
+
+#define NR_MANAGERS ((int)(sizeof(managers) / sizeof(managers[0])))
+
+const struct pmm_manager *pmm_manager_at(int i) {
+    return (i >= 0 && i < NR_MANAGERS) ? managers[i] : NULL;
+}
+
+// 名字可以写全称，也可以省略 "_pmm_manager" 后缀
+const struct pmm_manager *pmm_lookup(const char *name) {
+    size_t len = strlen(name);
+    for (int i = 0; i < NR_MANAGERS; i++) {
+        const char *full = managers[i]->name;
+        if (strcmp(full, name) == 0) return managers[i];
+        if (strncmp(full, name, len) == 0 && strcmp(full + len, "_pmm_manager") == 0)
+            return managers[i];
+    }
+    return NULL;
+}
+
+static uint64_t host_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t pmm_host_init(const struct pmm_manager *m, size_t n, int nranges) {
+    assert(n > 0 && nranges > 0 && (size_t)nranges <= n);
+    pmm_host_fini();
+    pages = calloc(n, sizeof(struct Page));
+    if (pages == NULL) {
+        fprintf(stderr, "pmm_host_init: cannot allocate %lu pages\n", (unsigned long)n);
+        exit(1);
+    }
+    npage = n;
+    for (size_t i = 0; i < n; i++) {
+        SetPageReserved(pages + i);
+    }
+    pmm_manager = m;
+    uint64_t t0 = host_now_ns();
+    pmm_manager->init();
+    size_t start = 0;
+    for (int i = 1; i <= nranges; i++) {
+        size_t end = n * i / nranges;
+        pmm_manager->init_memmap(pages + start, end - start);
+        start = end;
+    }
+    return host_now_ns() - t0;
+}
+
+static void *backing;
+static size_t backing_len;
+
+void pmm_host_backing(void) {
+    assert(backing == NULL && npage > 0);
+    backing_len = npage * PGSIZE;
+    backing = mmap(NULL, backing_len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (backing == MAP_FAILED) {
+        fprintf(stderr, "pmm_host_backing: cannot map %lu pages\n", (unsigned long)npage);
+        exit(1);
+    }
+    va_pa_offset = (uint64_t)(uintptr_t)backing - nbase * PGSIZE;
+}
+
+void pmm_host_fini(void) {
+    if (backing != NULL) {
+        munmap(backing, backing_len);
+        backing = NULL;
+        va_pa_offset = 0;
+    }
+    free(pages);
+    pages = NULL;
+    npage = 0;
+}
+
+// 宿主机上没有中断，不需要 local_intr_save/restore；多线程互斥由各管理器自己的锁负责
+struct Page *alloc_pages(size_t n) {
+    return pmm_manager->alloc_pages(n);
+}
+
+struct Page *alloc_pages_mt(size_t n, int mt) {
+    if (pmm_manager->alloc_pages_mt == NULL) {
+        return pmm_manager->alloc_pages(n);
+    }
+    return pmm_manager->alloc_pages_mt(n, mt);
+}
+
+struct Page *alloc_pages_aligned(size_t n, size_t align) {
+    assert(align > 0 && (align & (align - 1)) == 0);
+    if (pmm_manager->alloc_pages_aligned != NULL) {
+        return pmm_manager->alloc_pages_aligned(n, align);
+    }
+    struct Page *p = pmm_manager->alloc_pages(n);
+    if (p != NULL && ((size_t)(p - pages) & (align - 1)) != 0) {
+        pmm_manager->free_pages(p, n);
+        p = NULL;
+    }
+    return p;
+}
+
+void free_pages(struct Page *base, size_t n) {
+    pmm_manager->free_pages(base, n);
+}
+
+size_t pmm_init_deferred(size_t budget) {
+    if (pmm_manager->init_deferred == NULL) {
+        return 0;
+    }
+    return pmm_manager->init_deferred(budget);
+}
+
+size_t nr_free_pages(void) {
+    return pmm_manager->nr_free_pages();
+}
@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <pmm.h>
+#include <smp.h>
+#include <slub.h>
+#include <zpool.h>
+#include "host_pmm.h"
+
+/*
+ * slub 基准：slub.c 原样编译，pages[] 配上真正的后备内存，页分配走 -m 指定的 pmm 管理器。
+ *
+ *   slub_bench [-m 管理器] [-n 页数] [-o 轮数] [-t 线程数] [-c]
+ *
+ * 单 hart，对每个 size class 量两种模式下每次 kmalloc/kfree 的周期数（x86 上是 rdtsc）：
+ *   pair   kmalloc 紧跟 kfree，反复同一个对象
+ *   batch  连续 kmalloc BATCH 个，再按分配顺序全部 kfree，分别计 alloc 与 free
+ * 同样的 batch 再用 kmalloc_bulk / kfree_bulk 各一次调用做完，和逐个调用的循环比每个对象的周期数；
+ * ilv 两列按步长 ILV_STRIDE 打乱释放顺序，让几个 slab 的对象交错出现，再比一次逐个 kfree 与 kfree_bulk。
+ * 顺序或交错里过半的轮 kfree_bulk 比循环慢出 BULK_SLACK% 以上，该行末尾标 *，带 -c 时以非 0 退出。
+ * 然后按几种贴近实际的大小分布各分配 BATCH 个再全部释放，报告每次 kmalloc/kfree 的周期数
+ * 与内部碎片（1 - 请求字节 / ksize 字节）：
+ *   uniform  1..2048 均匀
+ *   log      [2^k, 2^(k+1)) 中均匀，k 在 3..10 间均匀，小对象居多
+ *   structs  一组常见内核结构体的大小（inode、dentry、skb 头之类量级），等概率
+ * 换一套 size class 对比：make slub DEFS=-DSLUB_SIZE_CLASSES=8,16,32,64,128,256,512,1024,2048。
+ * 大块（超过最大 class 直接走页）按 big_sizes 各分配 BATCH 个再释放，报告每个占几页、是否页对齐与 alloc/free 周期。
+ * 再拿一个 200B 的“内核对象”比较两种用法，各 BATCH 个分配再释放，计每个对象 alloc+初始化 与 free 的周期：
+ *   kmalloc  kmalloc 后当场初始化（落到 256 的 class）
+ *   cache    kmem_cache_create 的专用 cache，ctor 只在建 slab 时跑，alloc 拿到的已经初始化好
+ * -t T 时再测跨 hart 释放：T 个线程各分配 BATCH 个对象，栅栏后每个线程释放左邻线程的那批，
+ * 报告每次操作的平均周期数（墙钟换算）。结束时 slub_flush_all + slub_shrink(1)，核对页数全部还回 pmm。
+ * 对比前后两种实现：make slub DEFS=-DSLUB_CPU_CACHE=0。
+ */
+
+#define DEFAULT_NPAGES  32256
+#define DEFAULT_ROUNDS  2000
+#define BATCH           256
+
+static const size_t sizes[] = {8, 64, 256, 1024, 2048};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static inline uint64_t cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* 墙钟时间换算成周期，用于多线程一段的汇总 */
+static double cycles_per_ns;
+
+static void calibrate(void) {
+    uint64_t n0 = now_ns(), c0 = cycles();
+    while (now_ns() - n0 < 20000000)
+        ;
+    cycles_per_ns = (double)(cycles() - c0) / (double)(now_ns() - n0);
+}
+
+static void *objs[NR_HARTS][BATCH];
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static inline uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static const size_t struct_sizes[] = {
+    24, 40, 56, 72, 104, 136, 168, 200, 232, 264, 328, 456, 520, 704, 1100, 1600,
+};
+
+static size_t mix_uniform(void) { return 1 + rng_next() % 2048; }
+static size_t mix_log(void) {
+    int k = 3 + (int)(rng_next() % 8);
+    return ((size_t)1 << k) + rng_next() % ((size_t)1 << k);
+}
+static size_t mix_structs(void) {
+    return struct_sizes[rng_next() % (sizeof(struct_sizes) / sizeof(struct_sizes[0]))];
+}
+
+static const size_t big_sizes[] = {3000, 4096, 8192, 12288, 16384};
+
+static const struct mix {
+    const char *name;
+    size_t (*sample)(void);
+} mixes[] = {
+    {"uniform", mix_uniform},
+    {"log", mix_log},
+    {"structs", mix_structs},
+};
+
+static void run_big(size_t rounds) {
+    printf("  %-6s %8s %8s %12s %12s\n", "big", "pages", "aligned", "alloc", "free");
+    if (rounds > 100) rounds = 100;     /* 每次都走 pmm，轮数多了只是拖时间 */
+    for (size_t i = 0; i < sizeof(big_sizes) / sizeof(big_sizes[0]); i++) {
+        size_t sz = big_sizes[i], free_before = nr_free_pages(), used = 0, aligned = 0;
+        /* -n 很小时一批只用一半的空闲页 */
+        size_t nb = BATCH, np = (sz + PGSIZE - 1) / PGSIZE;
+        if (nb * np > free_before / 2) nb = free_before / 2 / np;
+        if (nb == 0) continue;
+        uint64_t ca = 0, cf = 0;
+        for (size_t r = 0; r < rounds; r++) {
+            uint64_t t0 = cycles();
+            for (size_t k = 0; k < nb; k++) {
+                objs[0][k] = kmalloc(sz);
+                assert(objs[0][k] != NULL);
+            }
+            uint64_t t1 = cycles();
+            if (r == 0) {
+                used = free_before - nr_free_pages();
+                for (size_t k = 0; k < nb; k++) aligned += ((uintptr_t)objs[0][k] & (PGSIZE - 1)) == 0;
+            }
+            for (size_t k = 0; k < nb; k++) kfree(objs[0][k]);
+            cf += cycles() - t1;
+            ca += t1 - t0;
+        }
+        size_t n = rounds * nb;
+        printf("  %-6lu %8.2f %7lu%% %12.1f %12.1f\n", (unsigned long)sz, (double)used / (double)nb,
+               (unsigned long)(aligned * 100 / nb), (double)ca / (double)n, (double)cf / (double)n);
+    }
+}
+
+/* 200B，初始化是清零加几个字段，量级上像 inode / task 之类 */
+struct bench_obj {
+    list_entry_t link, children;
+    uint32_t lock, state;
+    uint64_t counters[16];
+    char name[40];
+};
+
+static void bench_obj_ctor(void *p) {
+    struct bench_obj *o = p;
+    memset(o, 0, sizeof(*o));
+    list_init(&o->link);
+    list_init(&o->children);
+    o->state = 1;
+}
+
+/* 留到 -c 的统计之后再 destroy */
+static struct kmem_cache *kc;
+
+static void run_ctor(size_t rounds) {
+    kc = kmem_cache_create("bench_obj", sizeof(struct bench_obj), 0, bench_obj_ctor);
+    assert(kc != NULL);
+    printf("  %-8s %12s %12s   (%lu-byte object)\n", "ctor", "alloc+init", "free",
+           (unsigned long)sizeof(struct bench_obj));
+    for (int mode = 0; mode < 2; mode++) {
+        uint64_t ca = 0, cf = 0;
+        for (size_t r = 0; r < rounds; r++) {
+            uint64_t t0 = cycles();
+            for (int k = 0; k < BATCH; k++) {
+                struct bench_obj *o;
+                if (mode == 0) {
+                    o = kmalloc(sizeof(*o));
+                    assert(o != NULL);
+                    bench_obj_ctor(o);
+                } else {
+                    o = kmem_cache_alloc(kc);
+                    assert(o != NULL && o->state == 1);
+                }
+                objs[0][k] = o;
+            }
+            uint64_t t1 = cycles();
+            for (int k = 0; k < BATCH; k++) {
+                if (mode == 0) kfree(objs[0][k]);
+                else           kmem_cache_free(kc, objs[0][k]);
+            }
+            cf += cycles() - t1;
+            ca += t1 - t0;
+        }
+        size_t n = rounds * BATCH;
+        printf("  %-8s %12.1f %12.1f\n", mode == 0 ? "kmalloc" : "cache",
+               (double)ca / (double)n, (double)cf / (double)n);
+    }
+}
+
+static void run_single(size_t rounds) {
+    printf("  %-6s %10s %12s %12s\n", "size", "pair", "batch alloc", "batch free");
+    for (size_t i = 0; i < NSIZES; i++) {
+        size_t sz = sizes[i];
+        size_t n = rounds * BATCH;
+
+        uint64_t t0 = cycles();
+        for (size_t k = 0; k < n; k++) {
+            void *p = kmalloc(sz);
+            assert(p != NULL);
+            *(volatile uint8_t *)p = (uint8_t)k;
+            kfree(p);
+        }
+        uint64_t pair = cycles() - t0;
+
+        uint64_t ca = 0, cf = 0;
+        for (size_t r = 0; r < rounds; r++) {
+            t0 = cycles();
+            for (int k = 0; k < BATCH; k++) {
+                objs[0][k] = kmalloc(sz);
+                assert(objs[0][k] != NULL);
+            }
+            uint64_t t1 = cycles();
+            for (int k = 0; k < BATCH; k++) kfree(objs[0][k]);
+            cf += cycles() - t1;
+            ca += t1 - t0;
+        }
+        printf("  %-6lu %10.1f %12.1f %12.1f\n", (unsigned long)sz,
+               (double)pair / (double)n, (double)ca / (double)n, (double)cf / (double)n);
+    }
+}
+
+/* 交错释放的步长，和 BATCH 互素：相邻两次释放隔开 ILV_STRIDE 个对象，落在不同 slab 上 */
+#define ILV_STRIDE 17
+/* 一轮里 kfree_bulk 比逐个 kfree 慢出这么多（百分比）算这一轮输了；过半的轮输了就标出来 */
+#define BULK_SLACK 10
+
+static int bulk_lost(uint64_t bulk, uint64_t loop) {
+    return bulk * 100 > loop * (100 + BULK_SLACK);
+}
+
+/* 返回 kfree_bulk 比逐个 kfree 慢的 size 个数（顺序、交错任一种慢都算） */
+static int run_bulk(size_t rounds) {
+    int slower = 0;
+    printf("  %-6s %12s %12s %12s %12s %12s %12s\n", "bulk", "loop alloc", "bulk alloc",
+           "loop free", "bulk free", "ilv loop", "ilv bulk");
+    for (size_t i = 0; i < NSIZES; i++) {
+        size_t sz = sizes[i];
+        uint64_t la = 0, lf = 0, ba = 0, bf = 0, il = 0, ib = 0, ilv[2] = {0, 0};
+        size_t lost = 0, ilv_lost = 0;
+        for (size_t r = 0; r < rounds; r++) {
+            uint64_t t0 = cycles();
+            for (int k = 0; k < BATCH; k++) {
+                objs[0][k] = kmalloc(sz);
+                assert(objs[0][k] != NULL);
+            }
+            uint64_t t1 = cycles();
+            for (int k = 0; k < BATCH; k++) kfree(objs[0][k]);
+            uint64_t t2 = cycles();
+            size_t got = kmalloc_bulk(sz, BATCH, objs[0]);
+            uint64_t t3 = cycles();
+            assert(got == BATCH);
+            kfree_bulk(objs[0], BATCH);
+            uint64_t t4 = cycles();
+            la += t1 - t0;
+            lf += t2 - t1;
+            ba += t3 - t2;
+            bf += t4 - t3;
+            lost += bulk_lost(t4 - t3, t2 - t1);
+
+            /* 交错：几个 slab 的对象轮流出现，同一 slab 的不相邻 */
+            for (int pass = 0; pass < 2; pass++) {
+                got = kmalloc_bulk(sz, BATCH, objs[0]);
+                assert(got == BATCH);
+                for (int k = 0; k < BATCH; k++) objs[1][k] = objs[0][(k * ILV_STRIDE) % BATCH];
+                t0 = cycles();
+                if (pass == 0) {
+                    for (int k = 0; k < BATCH; k++) kfree(objs[1][k]);
+                } else {
+                    kfree_bulk(objs[1], BATCH);
+                }
+                ilv[pass] = cycles() - t0;
+            }
+            il += ilv[0];
+            ib += ilv[1];
+            ilv_lost += bulk_lost(ilv[1], ilv[0]);
+        }
+        double n = (double)(rounds * BATCH);
+        int slow = lost * 2 > rounds || ilv_lost * 2 > rounds;
+        printf("  %-6lu %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f%s\n", (unsigned long)sz,
+               (double)la / n, (double)ba / n, (double)lf / n, (double)bf / n,
+               (double)il / n, (double)ib / n, slow ? "  *" : "");
+        slower += slow;
+    }
+    return slower;
+}
+
+static void run_mixes(size_t rounds) {
+    static size_t req[BATCH];
+    printf("  %-8s %12s %12s %14s\n", "mix", "alloc", "free", "internal frag");
+    for (size_t i = 0; i < sizeof(mixes) / sizeof(mixes[0]); i++) {
+        uint64_t ca = 0, cf = 0, want = 0, got = 0;
+        rng_state = 88172645463325252ull;
+        for (size_t r = 0; r < rounds; r++) {
+            for (int k = 0; k < BATCH; k++) req[k] = mixes[i].sample();
+            uint64_t t0 = cycles();
+            for (int k = 0; k < BATCH; k++) {
+                objs[0][k] = kmalloc(req[k]);
+                assert(objs[0][k] != NULL);
+            }
+            uint64_t t1 = cycles();
+            for (int k = 0; k < BATCH; k++) {
+                want += req[k];
+                got += ksize(objs[0][k]);
+            }
+            uint64_t t2 = cycles();
+            for (int k = 0; k < BATCH; k++) kfree(objs[0][k]);
+            cf += cycles() - t2;
+            ca += t1 - t0;
+        }
+        size_t n = rounds * BATCH;
+        printf("  %-8s %12.1f %12.1f %13.1f%%\n", mixes[i].name,
+               (double)ca / (double)n, (double)cf / (double)n,
+               100.0 * (double)(got - want) / (double)got);
+    }
+}
+
+struct worker {
+    pthread_t tid;
+    int hart, nthreads;
+    size_t rounds, sz;
+    pthread_barrier_t *bar;
+};
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    host_hart_id = w->hart;
+    int left = (w->hart + w->nthreads - 1) % w->nthreads;
+    for (size_t r = 0; r < w->rounds; r++) {
+        for (int k = 0; k < BATCH; k++) {
+            objs[w->hart][k] = kmalloc(w->sz);
+            assert(objs[w->hart][k] != NULL);
+        }
+        pthread_barrier_wait(w->bar);
+        for (int k = 0; k < BATCH; k++) kfree(objs[left][k]);
+        pthread_barrier_wait(w->bar);
+    }
+    return NULL;
+}
+
+static void run_remote(size_t rounds, int nthreads) {
+    struct worker w[NR_HARTS];
+    pthread_barrier_t bar;
+    printf("  cross-hart free, %d threads (cycles per kmalloc+kfree, wall)\n", nthreads);
+    for (size_t i = 0; i < NSIZES; i++) {
+        pthread_barrier_init(&bar, NULL, nthreads);
+        uint64_t s = now_ns();
+        for (int t = 0; t < nthreads; t++) {
+            w[t] = (struct worker){
+                .hart = t, .nthreads = nthreads, .rounds = rounds, .sz = sizes[i], .bar = &bar,
+            };
+            if (pthread_create(&w[t].tid, NULL, worker_main, &w[t]) != 0) {
+                fprintf(stderr, "slub_bench: pthread_create failed\n");
+                exit(1);
+            }
+        }
+        for (int t = 0; t < nthreads; t++) pthread_join(w[t].tid, NULL);
+        uint64_t el = now_ns() - s;
+        pthread_barrier_destroy(&bar);
+        /* 每个线程 rounds*BATCH 对操作，墙钟内并行 */
+        double per = (double)el * cycles_per_ns / (double)(rounds * BATCH);
+        printf("  %-6lu %10.1f\n", (unsigned long)sizes[i], per);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-m manager] [-n npages] [-o rounds] [-t threads] [-c]\n"
+            "  manager: best_fit | buddy | bitmap | tlsf (default buddy)\n"
+            "  -o       rounds of %d objects per size class (default %d)\n"
+            "  -t       also measure cross-hart frees with T threads\n"
+            "  -c       dump slub stats and run the invariant check at the end\n",
+            prog, BATCH, DEFAULT_ROUNDS);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *mname = "buddy";
+    size_t npages = DEFAULT_NPAGES, rounds = DEFAULT_ROUNDS;
+    int threads = 0, check = 0, c;
+
+    while ((c = getopt(argc, argv, "m:n:o:t:ch")) != -1) {
+        switch (c) {
+        case 'm': mname = optarg; break;
+        case 'n': npages = strtoul(optarg, NULL, 0); break;
+        case 'o': rounds = strtoul(optarg, NULL, 0); break;
+        case 't': threads = atoi(optarg); break;
+        case 'c': check = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (npages == 0 || rounds == 0) usage(argv[0]);
+    if (threads < 0 || threads > NR_HARTS || threads == 1) usage(argv[0]);
+
+    const struct pmm_manager *m = pmm_lookup(mname);
+    if (m == NULL) {
+        fprintf(stderr, "slub_bench: unknown manager '%s'\n", mname);
+        usage(argv[0]);
+    }
+    pmm_host_init(m, npages, 1);
+    pmm_host_backing();
+    slub_init();
+    zpool_init();
+    calibrate();
+    size_t free0 = nr_free_pages();
+
+    printf("slub on %s: npages=%lu rounds=%lu batch=%d (cycles per op)\n",
+           m->name, (unsigned long)npages, (unsigned long)rounds, BATCH);
+    run_single(rounds);
+    int bulk_slower = run_bulk(rounds);
+    run_mixes(rounds);
+    run_big(rounds);
+    run_ctor(rounds);
+    if (threads > 0) run_remote(rounds, threads);
+
+    if (check) {
+        slub_dump_stats(0);
+        slub_check_invariants(1);
+    }
+    int rc = kmem_cache_destroy(kc);
+    assert(rc == 0);
+    slub_flush_all();
+    slub_shrink(1);
+    assert(nr_free_pages() == free0);
+    if (check) slub_check_invariants(1);
+    pmm_host_fini();
+    if (check && bulk_slower > 0) {
+        fprintf(stderr, "slub_bench: kfree_bulk slower than a kfree loop for %d size(s)\n", bulk_slower);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include <pmm.h>
+#include <sync.h>
+#include <pmm_bulk.h>
+
+/* 希尔排序：就地、不用额外内存，批量一般只有几十到几百块 */
+void pmm_sort_blocks(struct Page **v, size_t cnt) {
+    for (size_t gap = cnt / 2; gap > 0; gap /= 2) {
+        for (size_t i = gap; i < cnt; i++) {
+            struct Page *x = v[i];
+            size_t j = i;
+            for (; j >= gap && v[j - gap] > x; j -= gap) v[j] = v[j - gap];
+            v[j] = x;
+        }
+    }
+}
+
+size_t alloc_pages_bulk(size_t n, size_t count, struct Page **out) {
+    size_t got = 0;
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    if (pmm_manager->alloc_pages_bulk != NULL) {
+        got = pmm_manager->alloc_pages_bulk(n, count, out);
+    } else {
+        while (got < count && (out[got] = pmm_manager->alloc_pages(n)) != NULL) got++;
+    }
+    local_intr_restore(intr_flag);
+    return got;
+}
+
+void free_pages_bulk(struct Page **blocks, size_t n, size_t count) {
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    if (pmm_manager->free_pages_bulk != NULL) {
+        pmm_manager->free_pages_bulk(blocks, n, count);
+    } else {
+        for (size_t i = 0; i < count; i++) pmm_manager->free_pages(blocks[i], n);
+    }
+    local_intr_restore(intr_flag);
+}
@@ -0,0 +1,20 @@
+#ifndef __KERN_MM_PMM_BULK_H__
+#define __KERN_MM_PMM_BULK_H__
+
+#include <defs.h>
+
+struct Page;
+
+/*
+ * 批量页分配的入口，分派到 pmm_manager 的 alloc_pages_bulk / free_pages_bulk 钩子；
+ * 管理器没提供钩子时退回逐块 alloc_pages / free_pages。内核里与 pmm.c 同放在 kern/mm。
+ */
+/* 一次分配 count 个 n 页的块写入 out[]，返回实际分配到的块数 */
+size_t alloc_pages_bulk(size_t n, size_t count, struct Page **out);
+/* 一次释放 count 个 n 页的块；会就地按地址重排 blocks[] */
+void free_pages_bulk(struct Page **blocks, size_t n, size_t count);
+
+/* 各管理器的批量释放共用：按地址对块指针排序，地址连续的块可以拼成一段一起合并 */
+void pmm_sort_blocks(struct Page **v, size_t cnt);
+
+#endif /* !__KERN_MM_PMM_BULK_H__ */
@@ -0,0 +1,78 @@
+#include <defs.h>
+#include <stdio.h>
+#include <assert.h>
+#include <memlayout.h>
+#include <pmm.h>
+#include <smp.h>
+
+/*
+ * 多 hart 启动：OpenSBI 只把一个 hart 送进 kern_entry，其余 hart 停在 SBI 里，
+ * 由启动 hart 通过 HSM 扩展的 sbi_hart_start 逐个拉起。从核从 secondary_entry
+ * （entry_smp.S）进来，装上和主核同一张 boot_page_table_sv39，切到自己的栈，
+ * 然后在 smp_secondary_main 里执行 smp_boot 交给它的函数。
+ */
+
+#define SBI_EXT_HSM         0x48534D
+#define SBI_HSM_HART_START  0
+
+extern uint64_t boot_hartid;
+extern char secondary_entry[];
+
+/* 从核的内核栈，entry_smp.S 按 hartid 取 hart_stacks[hartid + 1] 的底部 */
+uint8_t hart_stacks[NR_HARTS][KSTACKSIZE] __attribute__((aligned(PGSIZE)));
+
+static volatile int nr_online;
+static void (*volatile secondary_fn)(void);
+
+static long sbi_hart_start(uint64_t hartid, uint64_t start_addr, uint64_t opaque) {
+    register uint64_t a0 asm("a0") = hartid;
+    register uint64_t a1 asm("a1") = start_addr;
+    register uint64_t a2 asm("a2") = opaque;
+    register uint64_t a6 asm("a6") = SBI_HSM_HART_START;
+    register uint64_t a7 asm("a7") = SBI_EXT_HSM;
+    asm volatile("ecall"
+                 : "+r"(a0), "+r"(a1)
+                 : "r"(a2), "r"(a6), "r"(a7)
+                 : "memory");
+    return (long)a0;
+}
+
+void smp_init(void) {
+    assert(boot_hartid < NR_HARTS);
+    asm volatile("mv tp, %0" : : "r"(boot_hartid));
+    nr_online = 1;
+}
+
+int smp_nr_online(void) {
+    return nr_online;
+}
+
+void smp_secondary_main(uint64_t hartid) {
+    __sync_fetch_and_add(&nr_online, 1);
+    void (*fn)(void) = secondary_fn;
+    if (fn != NULL) {
+        fn();
+    }
+    while (1) {
+        asm volatile("wfi");
+    }
+}
+
+/*
+ * 拉起除自己以外的所有 hart，每个都等它报到后再拉下一个。
+ * hart 不存在时 SBI 返回错误，直接跳过。
+ */
+void smp_boot(void (*fn)(void)) {
+    secondary_fn = fn;
+    __sync_synchronize();
+    uintptr_t entry_pa = (uintptr_t)secondary_entry - va_pa_offset;
+    for (uint64_t h = 0; h < NR_HARTS; h++) {
+        if (h == boot_hartid) continue;
+        int before = nr_online;
+        long ret = sbi_hart_start(h, entry_pa, 0);
+        if (ret != 0) continue;
+        while (nr_online == before)
+            ;
+    }
+    cprintf("smp: %d hart(s) online\n", nr_online);
+}
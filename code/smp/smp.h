@@ -0,0 +1,22 @@
+#ifndef __KERN_SMP_SMP_H__
+#define __KERN_SMP_SMP_H__
+
+#include <defs.h>
+
+/* QEMU virt 默认最多拉起 4 个 hart，可用 -DNR_HARTS=N 覆盖 */
+#ifndef NR_HARTS
+#define NR_HARTS 4
+#endif
+
+/* 每个 hart 进内核时把自己的 hartid 放进 tp，之后 tp 不再改动 */
+static inline int cpuid(void) {
+    int id;
+    asm volatile("mv %0, tp" : "=r"(id));
+    return id;
+}
+
+void smp_init(void);
+void smp_boot(void (*fn)(void));
+int smp_nr_online(void);
+
+#endif /* !__KERN_SMP_SMP_H__ */
@@ -0,0 +1,36 @@
+#ifndef __KERN_SYNC_SPINLOCK_H__
+#define __KERN_SYNC_SPINLOCK_H__
+
+#include <defs.h>
+
+/*
+ * 最小的自旋锁：__sync_lock_test_and_set 在 RV64A 上编译成 amoswap.w.aq，
+ * __sync_lock_release 编译成 fence + sw，不依赖 libgcc。
+ * 只管多 hart 互斥，不关中断；需要防中断重入的调用者自己包 local_intr_save。
+ */
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock_init(spinlock_t *lock) {
+    lock->locked = 0;
+}
+
+static inline void spin_lock(spinlock_t *lock) {
+    while (__sync_lock_test_and_set(&lock->locked, 1)) {
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+static inline bool spin_trylock(spinlock_t *lock) {
+    return __sync_lock_test_and_set(&lock->locked, 1) == 0;
+}
+
+static inline void spin_unlock(spinlock_t *lock) {
+    __sync_lock_release(&lock->locked);
+}
+
+#endif /* !__KERN_SYNC_SPINLOCK_H__ */
@@ -0,0 +1,374 @@
+#include <pmm.h>
+#include <list.h>
+#include <string.h>
+#include <stdio.h>
+#include <memlayout.h>
+#include <spinlock.h>
+#include <tlsf_pmm.h>
+#include <pmm_bulk.h>
+
+/*
+ * TLSF（two-level segregated fit）页分配器：
+ * - 空闲块按页数分到二级桶里：一级 fl 取 floor(log2(size))，二级 sl 把 [2^fl, 2^(fl+1))
+ *   再均分成 SL_COUNT 份；小于 SL_COUNT 的块全放在 fl = 0，按 size 直接分桶。
+ * - fl_bitmap 记录哪些一级非空，sl_bitmap[fl] 记录该一级下哪些二级非空，
+ *   查找只需两次 ctz，不遍历任何链表。
+ * - 分配时把请求向上取整到下一个桶的下界，桶里任何块都够大，直接取表头；
+ *   取整后找不到时再看一眼请求本身所在桶的表头，免得恰好够大的唯一大块被漏掉。
+ * - 边界标记与 best-fit 相同：首页 PG_property、尾页 PG_tail，两页的 property 都记块大小，
+ *   释放时看 base-1 与 base+n 即可 O(1) 合并。
+ * alloc/free 都是常数步，最坏延迟与空闲块个数无关。
+ */
+
+#define SL_SHIFT    4
+#define SL_COUNT    (1 << SL_SHIFT)
+#define FL_COUNT    27              /* 最大可管理 2^30 页的块 */
+
+#define PG_tail 2
+
+#define SetPageTail(page) set_bit(PG_tail, &((page)->flags))
+#define ClearPageTail(page) clear_bit(PG_tail, &((page)->flags))
+#define PageTail(page) test_bit(PG_tail, &((page)->flags))
+
+static list_entry_t free_lists[FL_COUNT][SL_COUNT];
+static uint32_t fl_bitmap;
+static uint32_t sl_bitmap[FL_COUNT];
+static size_t nr_free;
+static spinlock_t pool_lock;        /* 保护 free_lists、两级位图与 nr_free */
+
+extern struct Page *pages;
+extern size_t npage;
+
+/* ========= 位运算小工具 ========= */
+/* de Bruijn 法求 ctz，避免依赖 libgcc 的 __ctzsi2；x 必须非 0 */
+static const uint8_t debruijn_ctz32[32] = {
+     0,  1, 28,  2, 29, 14, 24,  3, 30, 22, 20, 15, 25, 17,  4,  8,
+    31, 27, 13, 23, 21, 19, 16,  7, 26, 12, 18,  6, 11,  5, 10,  9,
+};
+
+static inline int ctz32(uint32_t x) {
+    return debruijn_ctz32[((x & -x) * 0x077cb531U) >> 27];
+}
+
+/* floor(log2(x))，x 必须非 0；二分，固定 6 步 */
+static inline int fls_size(size_t x) {
+    uint64_t v = x;
+    int r = 0;
+    if (v >> 32) { v >>= 32; r += 32; }
+    if (v >> 16) { v >>= 16; r += 16; }
+    if (v >> 8)  { v >>= 8;  r += 8; }
+    if (v >> 4)  { v >>= 4;  r += 4; }
+    if (v >> 2)  { v >>= 2;  r += 2; }
+    if (v >> 1)  { r += 1; }
+    return r;
+}
+
+/* ========= 桶映射 ========= */
+/* 块大小 -> 所在桶 */
+static inline void mapping_insert(size_t size, int *fl, int *sl) {
+    if (size < SL_COUNT) {
+        *fl = 0;
+        *sl = (int)size;
+    } else {
+        int t = fls_size(size);
+        *sl = (int)(size >> (t - SL_SHIFT)) ^ SL_COUNT;
+        *fl = t - SL_SHIFT + 1;
+    }
+}
+
+/* 请求大小 -> 桶内任何块都不小于它的最小桶 */
+static inline void mapping_search(size_t size, int *fl, int *sl) {
+    if (size >= SL_COUNT) {
+        size += ((size_t)1 << (fls_size(size) - SL_SHIFT)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+/* 从 (fl, sl) 起找第一个非空桶，返回表头块；没有则返回 NULL */
+static struct Page *find_suitable(int fl, int sl) {
+    if (fl >= FL_COUNT) return NULL;
+    uint32_t sl_map = sl_bitmap[fl] & (~0U << sl);
+    if (sl_map == 0) {
+        uint32_t fl_map = (fl + 1 < 32) ? (fl_bitmap & (~0U << (fl + 1))) : 0;
+        if (fl_map == 0) return NULL;
+        fl = ctz32(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+    sl = ctz32(sl_map);
+    return le2page(list_next(&free_lists[fl][sl]), page_link);
+}
+
+/* ========= 空闲块标记与挂链 ========= */
+static inline void set_free_block(struct Page *p, size_t n) {
+    p->property = n;
+    SetPageProperty(p);
+    if (n > 1) {
+        (p + n - 1)->property = n;
+        SetPageTail(p + n - 1);
+    }
+}
+
+/* 清除首尾边界标记，p->property 保持不变 */
+static inline void clear_free_block(struct Page *p) {
+    if (p->property > 1) {
+        ClearPageTail(p + p->property - 1);
+    }
+    ClearPageProperty(p);
+}
+
+static void block_insert(struct Page *p) {
+    int fl, sl;
+    mapping_insert(p->property, &fl, &sl);
+    assert(fl < FL_COUNT);
+    list_add(&free_lists[fl][sl], &(p->page_link));
+    fl_bitmap |= 1U << fl;
+    sl_bitmap[fl] |= 1U << sl;
+}
+
+/* 调用前 p 的 property 不能被修改 */
+static void block_remove(struct Page *p) {
+    int fl, sl;
+    mapping_insert(p->property, &fl, &sl);
+    list_del(&(p->page_link));
+    if (list_empty(&free_lists[fl][sl])) {
+        sl_bitmap[fl] &= ~(1U << sl);
+        if (sl_bitmap[fl] == 0) fl_bitmap &= ~(1U << fl);
+    }
+}
+
+/* 取走空闲块 p 的前 n 页，剩余部分挂回对应的桶 */
+static void block_take(struct Page *p, size_t n) {
+    size_t size = p->property;
+    block_remove(p);
+    clear_free_block(p);
+    if (size > n) {
+        set_free_block(p + n, size - n);
+        block_insert(p + n);
+    }
+    nr_free -= n;
+}
+
+/* 把 [base, base+size) 与物理相邻的空闲块合并后挂回；nr_free 已由调用者计入 */
+static void free_range(struct Page *base, size_t size) {
+    struct Page *p = base + size;
+    if (p < pages + (npage - nbase) && PageProperty(p)) {
+        block_remove(p);
+        clear_free_block(p);
+        size += p->property;
+    }
+    if (base > pages) {
+        p = base - 1;
+        if (PageTail(p)) p = base - p->property;
+        if (PageProperty(p)) {
+            block_remove(p);
+            clear_free_block(p);
+            size += p->property;
+            base = p;
+        }
+    }
+    set_free_block(base, size);
+    block_insert(base);
+}
+
+/* ========= pmm_manager 接口 ========= */
+static void tlsf_init(void) {
+    for (int i = 0; i < FL_COUNT; i++) {
+        for (int j = 0; j < SL_COUNT; j++) list_init(&free_lists[i][j]);
+        sl_bitmap[i] = 0;
+    }
+    fl_bitmap = 0;
+    nr_free = 0;
+    spin_lock_init(&pool_lock);
+}
+
+static void tlsf_init_memmap(struct Page *base, size_t n) {
+    assert(n > 0);
+    for (struct Page *p = base; p != base + n; p++) {
+        assert(PageReserved(p));
+        p->flags = 0;
+        p->property = 0;
+        set_page_ref(p, 0);
+    }
+    set_free_block(base, n);
+    block_insert(base);
+    nr_free += n;
+}
+
+/* pool_* 不加锁，由调用者持有 pool_lock */
+static struct Page *pool_alloc(size_t n) {
+    if (n > nr_free) return NULL;
+
+    int fl, sl;
+    mapping_search(n, &fl, &sl);
+    struct Page *p = find_suitable(fl, sl);
+    if (p == NULL) {
+        /* 取整后的桶都空了，请求所在桶的表头也可能够大 */
+        mapping_insert(n, &fl, &sl);
+        if (fl >= FL_COUNT || list_empty(&free_lists[fl][sl])) return NULL;
+        p = le2page(list_next(&free_lists[fl][sl]), page_link);
+        if (p->property < n) return NULL;
+    }
+    block_take(p, n);
+    return p;
+}
+
+/*
+ * 只有空闲块的首尾页带标记，已分配区间内部的页不会被本分配器改写，
+ * 所以这里只检查、清理首尾两页，不按页循环，保证释放也是常数步。
+ */
+static void pool_free(struct Page *base, size_t n) {
+    struct Page *last = base + n - 1;
+    assert(!PageReserved(base) && !PageProperty(base) && !PageTail(base));
+    assert(!PageReserved(last) && !PageProperty(last) && !PageTail(last));
+    set_page_ref(base, 0);
+    nr_free += n;
+    free_range(base, n);
+}
+
+static struct Page *tlsf_alloc_pages(size_t n) {
+    assert(n > 0);
+    spin_lock(&pool_lock);
+    struct Page *p = pool_alloc(n);
+    spin_unlock(&pool_lock);
+    return p;
+}
+
+static void tlsf_free_pages(struct Page *base, size_t n) {
+    assert(n > 0);
+    spin_lock(&pool_lock);
+    pool_free(base, n);
+    spin_unlock(&pool_lock);
+}
+
+/* 批量分配：先找一块能装下全部 count 块的空闲块一次切完，不够时逐块分配 */
+static size_t pool_alloc_bulk(size_t n, size_t count, struct Page **out) {
+    size_t got = 0;
+    if (count > 1 && n * count <= nr_free) {
+        int fl, sl;
+        mapping_search(n * count, &fl, &sl);
+        struct Page *p = find_suitable(fl, sl);
+        if (p != NULL) {
+            block_take(p, n * count);
+            for (; got < count; got++) out[got] = p + got * n;
+            return got;
+        }
+    }
+    while (got < count) {
+        struct Page *p = pool_alloc(n);
+        if (p == NULL) break;
+        out[got++] = p;
+    }
+    return got;
+}
+
+static size_t tlsf_alloc_pages_bulk(size_t n, size_t count, struct Page **out) {
+    assert(n > 0);
+    spin_lock(&pool_lock);
+    size_t got = pool_alloc_bulk(n, count, out);
+    spin_unlock(&pool_lock);
+    return got;
+}
+
+/* 批量释放：排序后地址连续的块拼成一段，每段只合并、挂链一次 */
+static void tlsf_free_pages_bulk(struct Page **v, size_t n, size_t count) {
+    assert(n > 0);
+    pmm_sort_blocks(v, count);
+    size_t i = 0;
+    spin_lock(&pool_lock);
+    while (i < count) {
+        struct Page *base = v[i];
+        size_t len = n;
+        while (++i < count && v[i] == base + len) len += n;
+        pool_free(base, len);
+    }
+    spin_unlock(&pool_lock);
+}
+
+static size_t tlsf_nr_free_pages(void) {
+    return nr_free;
+}
+
+/* ========= 自检 ========= */
+/* 核对位图、桶归属与首尾标记，返回空闲页总数 */
+static size_t tlsf_count_free(void) {
+    size_t total = 0;
+    for (int i = 0; i < FL_COUNT; i++) {
+        assert(((fl_bitmap >> i) & 1) == (sl_bitmap[i] != 0));
+        for (int j = 0; j < SL_COUNT; j++) {
+            list_entry_t *head = &free_lists[i][j], *le = head;
+            assert(((sl_bitmap[i] >> j) & 1) == !list_empty(head));
+            while ((le = list_next(le)) != head) {
+                struct Page *p = le2page(le, page_link);
+                int fl, sl;
+                mapping_insert(p->property, &fl, &sl);
+                assert(fl == i && sl == j && PageProperty(p));
+                assert(p->property == 1 ||
+                       (PageTail(p + p->property - 1) &&
+                        (p + p->property - 1)->property == p->property));
+                total += p->property;
+            }
+        }
+    }
+    return total;
+}
+
+static void tlsf_check(void) {
+    cprintf("[tlsf] 基本检查开始...\n");
+    size_t total = tlsf_nr_free_pages();
+    assert(tlsf_count_free() == total);
+
+    struct Page *a = tlsf_alloc_pages(1);
+    struct Page *b = tlsf_alloc_pages(3);
+    struct Page *c = tlsf_alloc_pages(40);
+    assert(a && b && c && a != b && b != c);
+    assert(tlsf_nr_free_pages() == total - 44);
+    assert(tlsf_count_free() == total - 44);
+
+    /* 中间块释放后两侧都已分配，不应合并 */
+    tlsf_free_pages(b, 3);
+    assert(PageProperty(b) && b->property == 3);
+    /* 两侧释放后三块连同剩余大块合并回去 */
+    tlsf_free_pages(a, 1);
+    tlsf_free_pages(c, 40);
+    assert(tlsf_count_free() == total);
+
+    struct Page *batch[16];
+    assert(tlsf_alloc_pages_bulk(2, 16, batch) == 16);
+    tlsf_free_pages_bulk(batch, 2, 16);
+
+    /* 按最大空闲块的大小整块分配，不能因为取整而失败；
+     * 内存被分成多段时空闲块不止一个，只有一块时才要求分完后位图清空 */
+    size_t largest = 0, nblocks = 0;
+    for (int i = 0; i < FL_COUNT; i++) {
+        for (int j = 0; j < SL_COUNT; j++) {
+            list_entry_t *head = &free_lists[i][j], *le = head;
+            while ((le = list_next(le)) != head) {
+                struct Page *q = le2page(le, page_link);
+                if (q->property > largest) largest = q->property;
+                nblocks++;
+            }
+        }
+    }
+    struct Page *p = tlsf_alloc_pages(largest);
+    assert(p != NULL && tlsf_nr_free_pages() == total - largest);
+    if (nblocks == 1) {
+        assert(tlsf_nr_free_pages() == 0 && fl_bitmap == 0);
+    }
+    tlsf_free_pages(p, largest);
+    assert(tlsf_nr_free_pages() == total && tlsf_count_free() == total);
+
+    cprintf("[tlsf] 检查通过，nr_free=%lu，空闲块 %lu 个，最大 %lu 页\n",
+            (unsigned long)total, (unsigned long)nblocks, (unsigned long)largest);
+}
+
+const struct pmm_manager tlsf_pmm_manager = {
+    .name           = "tlsf_pmm_manager",
+    .init           = tlsf_init,
+    .init_memmap    = tlsf_init_memmap,
+    .alloc_pages    = tlsf_alloc_pages,
+    .free_pages     = tlsf_free_pages,
+    .alloc_pages_bulk = tlsf_alloc_pages_bulk,
+    .free_pages_bulk  = tlsf_free_pages_bulk,
+    .nr_free_pages  = tlsf_nr_free_pages,
+    .check          = tlsf_check,
+};